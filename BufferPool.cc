@@ -0,0 +1,256 @@
+/*
+Copyright 2009 by Walt Howard
+$Id: BufferPool.cc 2428 2012-08-14 15:33:13Z whoward $
+*/
+
+#include <BufferPool.h>
+#include <Misc.h>
+#include <boost/thread/mutex.hpp>
+#include <atomic>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+namespace
+{
+    std::atomic<uint64_t> Acquired(0);
+    std::atomic<uint64_t> Reused(0);
+    std::atomic<uint64_t> Created(0);
+    std::atomic<uint64_t> Destroyed(0);
+    std::atomic<uint64_t> InUse(0);
+    std::atomic<uint64_t> PeakInUse(0);
+    std::atomic<uint64_t> Cached(0);
+
+    typedef std::vector<BufferPool::Block> Blocks;
+
+    void Using(const size_t bytes)
+    {
+	const uint64_t in_use = InUse += bytes;
+	uint64_t peak = PeakInUse;
+
+	while (in_use > peak and not PeakInUse.compare_exchange_weak(peak, in_use))
+	    ;
+    }
+
+    // size class for size, or -1 if too big to pool
+    int ClassOf(const size_t size)
+    {
+	for (int size_class = 0; size_class < BufferPool::CLASSES; ++size_class)
+	    if (size <= (static_cast<size_t>(1) << (BufferPool::SMALLEST_SHIFT + size_class)))
+		return size_class;
+
+	return -1;
+    }
+
+    size_t ClassSize(const int size_class)
+    {
+	return static_cast<size_t>(1) << (BufferPool::SMALLEST_SHIFT + size_class);
+    }
+
+    BufferPool::Block Create(const size_t size)
+    {
+	// the mirror is made of whole pages so round up to the next page
+	const size_t page = ::sysconf(_SC_PAGESIZE);
+	const size_t mapped_size = (size + page - 1) / page * page;
+
+	BufferPool::Block block = { NULL, 0, false };
+
+	int fd = ::memfd_create("Stream::Buffer", MFD_CLOEXEC);
+
+	if (fd != -1 and ::ftruncate(fd, mapped_size) != -1)
+	{
+	    // reserve address space for both copies, then map the same memory into each half.
+	    char* base = static_cast<char*>(::mmap(NULL, mapped_size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+
+	    if (base != MAP_FAILED)
+	    {
+		if (::mmap(base, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED and
+		    ::mmap(base + mapped_size, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED)
+		{
+		    block._data = base;
+		    block._size = mapped_size;
+		    block._mirrored = true;
+		}
+		else
+		    ::munmap(base, mapped_size * 2);
+	    }
+	}
+
+	if (fd != -1)
+	    ::close(fd);
+
+	if (not block._mirrored)
+	{
+	    block._data = new char[size + 1];
+	    block._size = size;
+	}
+
+	++Created;
+
+	return block;
+    }
+
+    void Destroy(const BufferPool::Block& block)
+    {
+	if (block._mirrored)
+	    ::munmap(block._data, block._size * 2);
+	else
+	    delete[] block._data;
+
+	++Destroyed;
+    }
+
+    struct Depot
+    {
+	boost::mutex _lock;
+	Blocks _free[BufferPool::CLASSES];
+
+	// take one of size_class, or return false
+	bool take(const int size_class, BufferPool::Block& block)
+	{
+	    boost::mutex::scoped_lock lock(_lock);
+
+	    if (_free[size_class].empty())
+		return false;
+
+	    block = _free[size_class].back();
+	    _free[size_class].pop_back();
+	    return true;
+	}
+
+	// keep block, or return false if there is no room for it
+	bool give(const int size_class, const BufferPool::Block& block)
+	{
+	    boost::mutex::scoped_lock lock(_lock);
+
+	    if ((_free[size_class].size() + 1) * ClassSize(size_class) > BufferPool::DEPOT_BYTES)
+		return false;
+
+	    _free[size_class].push_back(block);
+	    return true;
+	}
+    };
+
+    // never destroyed, so thread caches going away at exit still have somewhere to go
+    Depot& TheDepot()
+    {
+	static Depot* depot = new Depot;
+	return *depot;
+    }
+
+    void Discard(const BufferPool::Block& block)
+    {
+	Cached -= block._size;
+	Destroy(block);
+    }
+
+    /* Set once the calling thread's cache is destroyed. A stream that is itself thread_local, or is freed by another thread_local's
+       destructor, can still release a buffer after that, and it goes to the depot. Plain bool, so it is never destroyed. */
+    thread_local bool CacheGone = false;
+
+    struct ThreadCache
+    {
+	Blocks _free[BufferPool::CLASSES];
+
+	~ThreadCache()
+	{
+	    CacheGone = true;
+
+	    for (int size_class = 0; size_class < BufferPool::CLASSES; ++size_class)
+		for (size_t i = 0; i < _free[size_class].size(); ++i)
+		    if (not TheDepot().give(size_class, _free[size_class][i]))
+			Discard(_free[size_class][i]);
+	}
+    };
+
+    thread_local ThreadCache Cache;
+}
+
+BufferPool::Block BufferPool::Acquire(const size_t size)
+{
+    ++Acquired;
+
+    const int size_class = ClassOf(size);
+
+    if (improbable(size_class == -1))
+    {
+	Block block = Create(size);
+	Using(block._size);
+	return block;
+    }
+
+    Block block;
+    Blocks* cached = improbable(CacheGone) ? NULL : &Cache._free[size_class];
+
+    if (probable(cached and not cached->empty()))
+    {
+	block = cached->back();
+	cached->pop_back();
+	Cached -= block._size;
+	++Reused;
+    }
+    else if (TheDepot().take(size_class, block))
+    {
+	Cached -= block._size;
+	++Reused;
+    }
+    else
+	block = Create(ClassSize(size_class));
+
+    Using(block._size);
+
+    return block;
+}
+
+void BufferPool::Release(const Block& block)
+{
+    if (not block._data)
+	return;
+
+    InUse -= block._size;
+
+    const int size_class = ClassOf(block._size);
+
+    // too big to pool, or not one of ours
+    if (improbable(size_class == -1 or block._size != ClassSize(size_class)))
+    {
+	Destroy(block);
+	return;
+    }
+
+    Cached += block._size;
+
+    Blocks* cached = improbable(CacheGone) ? NULL : &Cache._free[size_class];
+
+    if (probable(cached and (cached->size() + 1) * block._size <= THREAD_CACHE_BYTES))
+	cached->push_back(block);
+    else if (not TheDepot().give(size_class, block))
+	Discard(block);
+}
+
+BufferPool::Stats BufferPool::Snapshot()
+{
+    Stats stats = { Acquired, Reused, Created, Destroyed, InUse, PeakInUse, Cached };
+    return stats;
+}
+
+void BufferPool::Trim()
+{
+    for (int size_class = 0; size_class < CLASSES; ++size_class)
+    {
+	if (not CacheGone)
+	{
+	    Blocks& cached = Cache._free[size_class];
+
+	    for (size_t i = 0; i < cached.size(); ++i)
+		Discard(cached[i]);
+
+	    cached.clear();
+	}
+
+	Block block;
+	while (TheDepot().take(size_class, block))
+	    Discard(block);
+    }
+}
@@ -0,0 +1,70 @@
+/*
+Copyright 2009 by Walt Howard
+$Id: BufferPool.h 2428 2012-08-14 15:33:13Z whoward $
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <stdint.h>
+#include <Statistics.h>
+
+/**
+   Read buffer storage for Streams, recycled instead of being made and unmade with every stream. Sizes are rounded up to a power of
+   two from 4 KB to 1 MB (the size classes). Each thread keeps a few of each class it has given back, and hands them out again
+   without locking. Beyond that they go to a depot shared by all threads, and beyond that back to the system. Bigger sizes aren't
+   pooled.
+
+   A block is a "magic ring" when it can be (one memfd mapped twice back to back, see Stream::Buffer), plain heap memory with one
+   byte to spare for a terminating null when it can't. Pooling saves the memfd, the mmaps and the page faults for every new stream.
+*/
+class BufferPool
+{
+public:
+    enum { SMALLEST_SHIFT = 12, CLASSES = 9 }; // 4 KB through 1 MB
+
+    // cached per thread, per size class, and in the depot, per size class
+    enum { THREAD_CACHE_BYTES = 1 << 20, DEPOT_BYTES = 16 << 20 };
+
+    struct Block
+    {
+	char* _data;
+	size_t _size; // usable bytes. For a ring, the size of one of the two mappings.
+	bool _mirrored;
+    };
+
+    struct Stats
+    {
+	uint64_t _acquired; // blocks handed out
+	uint64_t _reused; // of those, ones that came from a cache instead of the system
+	uint64_t _created; // blocks obtained from the system
+	uint64_t _destroyed; // blocks given back to the system
+	uint64_t _in_use_bytes; // handed out and not yet released
+	uint64_t _peak_in_use_bytes; // the most _in_use_bytes has been
+	uint64_t _cached_bytes; // held in thread caches and the depot
+    };
+
+    // Storage for at least size bytes.
+    static Block Acquire(const size_t size);
+
+    static void Release(const Block& block);
+
+    static Stats Snapshot();
+
+    // Set the numbers from Snapshot() as "buffer_pool.*" values in stats.
+    static void Publish(Statistics& stats)
+    {
+	const Stats snapshot = Snapshot();
+
+	stats.Set("buffer_pool.in_use_bytes", snapshot._in_use_bytes);
+	stats.Set("buffer_pool.peak_in_use_bytes", snapshot._peak_in_use_bytes);
+	stats.Set("buffer_pool.cached_bytes", snapshot._cached_bytes);
+	stats.Set("buffer_pool.acquired", snapshot._acquired);
+	stats.Set("buffer_pool.reused", snapshot._reused);
+	stats.Set("buffer_pool.created", snapshot._created);
+	stats.Set("buffer_pool.destroyed", snapshot._destroyed);
+    }
+
+    // Give everything in the depot and the calling thread's cache back to the system.
+    static void Trim();
+};
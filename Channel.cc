@@ -6,7 +6,7 @@ $Id: Channel.cc 2428 2012-08-14 15:33:13Z whoward $
 #include <Channel.h>
 
 Channel::Channel(const Channel::DIRECTION& direction) :
-    _direction(direction), _offset(0), _open(0)
+    _direction(direction), _offset(0), _open(0), _timeout_milliseconds(-1)
 {
 }
 
@@ -18,6 +18,11 @@ void Channel::endOfClass(const char* classname, const char* label)
 {
 }
 
+size_t Channel::serializeBlock(void*, const size_t&, const char* label)
+{
+    throw Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "This channel does not serialize blocks (%s)", label ? label : "");
+}
+
 Channel::~Channel()
 {
 }
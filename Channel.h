@@ -108,6 +108,7 @@ private:
     DIRECTION _direction;
     uint64_t _offset; // For debugging - how far into the stream an error occurred
     int _open;
+    int _timeout_milliseconds; // how long reading in waits for the rest of an item that is still arriving. -1 for as long as it takes
 
 protected:
     uint64_t incrementOffset(uint64_t amount)
@@ -124,6 +125,7 @@ public:
 
     GETSET(DIRECTION, _direction);
     GETSET(uint64_t, _offset);
+    GETSET(int, _timeout_milliseconds);
 
     const int& get_open() const
     {
@@ -174,6 +176,19 @@ public:
 
     virtual size_t serializeBool(bool*, const size_t& count, const char* label) = 0;
 
+    /**
+     Channels that store the raw in-memory representation can take a whole array of plain elements (see SerializeAsBlock in Serialize.h) as
+     one block of bytes instead of element by element. The vector and array serializers check blockable() and then write the element count
+     followed by serializeBlock() of the elements; reading in, they size the storage from the count and serializeBlock() fills it. The
+     default is to refuse, so the serializers go element by element.
+     */
+    virtual bool blockable() const
+    {
+	return false;
+    }
+
+    virtual size_t serializeBlock(void* block, const size_t& bytes, const char* label);
+
     /**
      Whenever a non-trivial class is serialized, these functions are called before and after serializing it. You do not have to use them but if you
      are doing something like serializing XML, you'll have to have your Channel class "open a tag" before serializing the object and "close the tag"
@@ -46,7 +46,8 @@ public:
 
     virtual void close(const char* = NULL)
     {
-        _stream << "\n";
+        if (get_direction() == OUT) // the stream is being read otherwise
+            _stream << "\n";
     }
 
     template<typename PRIMITIVE> size_t serializeAny(const PRIMITIVE* object,
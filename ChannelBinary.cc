@@ -0,0 +1,90 @@
+/*
+Copyright 2009 by Walt Howard
+$Id: ChannelBinary.cc 2428 2012-08-14 15:33:13Z whoward $
+*/
+
+#include <ChannelBinary.h>
+
+ChannelBinary::ChannelBinary(const Channel::DIRECTION& direction, Stream& stream, const size_t buffer_size, const int timeout_milliseconds) :
+    Channel(direction), _stream(stream), _output(direction == OUT ? GREATER(buffer_size, size_t(64)) : 0), _used(0)
+{
+    set_timeout_milliseconds(timeout_milliseconds);
+}
+
+void ChannelBinary::send(const struct iovec* pieces, const int count)
+{
+    size_t total = 0;
+    for (int i = 0; i < count; ++i)
+	total += pieces[i].iov_len;
+
+    if (_used + total <= _output.size())
+    {
+	for (int i = 0; i < count; ++i)
+	{
+	    ::memcpy(&_output[_used], pieces[i].iov_base, pieces[i].iov_len);
+	    _used += pieces[i].iov_len;
+	}
+	return;
+    }
+
+    // won't fit: out it all goes, the buffer first
+    struct iovec* frame = static_cast<struct iovec*>(alloca(sizeof(struct iovec) * (count + 1)));
+    frame[0].iov_base = &_output[0];
+    frame[0].iov_len = _used;
+    ::memcpy(frame + 1, pieces, sizeof(struct iovec) * count);
+
+    _stream.writeAllVector(frame, count + 1);
+    _used = 0;
+}
+
+void ChannelBinary::flush()
+{
+    if (not _used)
+	return;
+
+    _stream.writeAll(_used, &_output[0]);
+    _used = 0;
+}
+
+Text ChannelBinary::open(const char* package_name)
+{
+    if (get_direction() == Channel::OUT and not package_name)
+	throw Exception(LOCATION, "package_name required when serializing OUT");
+
+    Text name(package_name ? package_name : "");
+    set_open(1);
+    Serialize(*this, name, "package_header");
+    return name;
+}
+
+void ChannelBinary::close(const char*)
+{
+    if (get_direction() == Channel::OUT)
+	flush();
+}
+
+size_t ChannelBinary::serializeBlock(void* block, const size_t& bytes, const char*)
+{
+    if (get_direction() == OUT)
+    {
+	struct iovec piece = { block, bytes };
+	send(&piece, 1);
+    }
+    else
+	ReadSerialized(*this, _stream, block, bytes);
+
+    incrementOffset(bytes);
+    return bytes;
+}
+
+ChannelBinary::~ChannelBinary()
+{
+    try
+    {
+	flush();
+    }
+    catch (const std::exception& ex)
+    {
+	// a destructor can't throw, and there is no one left to tell
+    }
+}
@@ -0,0 +1,148 @@
+/*
+Copyright 2009 by Walt Howard
+$Id: ChannelBinary.h 2428 2012-08-14 15:33:13Z whoward $
+*/
+
+#pragma once
+
+#include <Channel.h>
+#include <Serialize.h>
+#include <Stream.h>
+#include <vector>
+
+/** @brief The raw internal representation to and from a Stream, like ChannelStream, but buffered and in bulk.
+
+ Going out, everything collects in a buffer and goes to the stream when the buffer is full, when an object is finished (close()), on
+ flush() and on destruction; anything too big for the buffer goes out along with what it holds in one writeAllVector(). Coming in, small
+ items come out of the stream's read buffer and big ones are read straight into place. Vectors, std::arrays and C arrays of numbers
+ (see SerializeAsBlock) are one count and one block of bytes rather than an item per element.
+
+ Each primitive is a size_t count followed by its bytes, as with ChannelStream, so the two read each other's data except for those
+ arrays. Reading waits as long as timeout_milliseconds (-1 for ever) for each item still arriving, then throws.
+ */
+
+class ChannelBinary: public Channel
+{
+    Stream& _stream;
+
+    std::vector<char> _output;
+    size_t _used; // how much of _output is waiting to go out
+
+    // OUT: the pieces, after whatever is in _output
+    void send(const struct iovec* pieces, const int count);
+
+public:
+    enum { DEFAULT_BUFFER_SIZE = 65536, DEFAULT_TIMEOUT = 30000 };
+
+    ChannelBinary(const Channel::DIRECTION& direction, Stream& stream, const size_t buffer_size = DEFAULT_BUFFER_SIZE,
+		  const int timeout_milliseconds = DEFAULT_TIMEOUT);
+
+    // Send what has been serialized out so far.
+    void flush();
+
+    virtual Text open(const char* package_name = NULL);
+
+    // an object is complete: send it
+    virtual void close(const char* = NULL);
+
+    virtual bool blockable() const
+    {
+	return true;
+    }
+
+    virtual size_t serializeBlock(void* block, const size_t& bytes, const char* label);
+
+    template<typename PRIMITIVE> size_t serializeAny(PRIMITIVE* object, const size_t count)
+    {
+        size_t amount(count);
+
+        if (get_direction() == OUT)
+        {
+            struct iovec frame[] = {
+                { &amount, sizeof(amount) },
+                { const_cast<char*> (reinterpret_cast<const char*> (object)), sizeof(PRIMITIVE) * amount }
+            };
+	    send(frame, 2);
+        }
+        else
+        {
+	    ReadSerialized(*this, _stream, &amount, sizeof(amount));
+
+	    if (improbable(amount > count))
+		ThrowSerializationException(*this, StringPrintf(0, "%zu items coming in to room for %zu", amount, count));
+
+	    ReadSerialized(*this, _stream, object, sizeof(PRIMITIVE) * amount);
+        }
+
+        incrementOffset(sizeof(PRIMITIVE) * amount);
+        return amount;
+    }
+
+    virtual size_t serializeChar(char* item, const size_t& count, const char*)
+    {
+        return serializeAny(item, count);
+    }
+
+    virtual size_t serializeUnsignedChar(unsigned char* item, const size_t& count, const char*)
+    {
+        return serializeAny(item, count);
+    }
+
+    virtual size_t serializeShort(short int* item, const size_t& count, const char*)
+    {
+        return serializeAny(item, count);
+    }
+
+    virtual size_t serializeUnsignedShort(unsigned short int* item, const size_t& count, const char*)
+    {
+        return serializeAny(item, count);
+    }
+
+    virtual size_t serializeInt(int* item, const size_t& count, const char*)
+    {
+        return serializeAny(item, count);
+    }
+
+    virtual size_t serializeUnsignedInt(unsigned int* item, const size_t& count, const char*)
+    {
+        return serializeAny(item, count);
+    }
+
+    virtual size_t serializeLong(long* item, const size_t& count, const char*)
+    {
+        return serializeAny(item, count);
+    }
+
+    virtual size_t serializeUnsignedLong(unsigned long* item, const size_t& count, const char*)
+    {
+        return serializeAny(item, count);
+    }
+
+    virtual size_t serializeLongLong(long long* item, const size_t& count, const char*)
+    {
+        return serializeAny(item, count);
+    }
+
+    virtual size_t serializeUnsignedLongLong(unsigned long long* item, const size_t& count, const char*)
+    {
+        return serializeAny(item, count);
+    }
+
+    virtual size_t serializeFloat(float* item, const size_t& count, const char*)
+    {
+        return serializeAny(item, count);
+    }
+
+    virtual size_t serializeDouble(double* item, const size_t& count, const char*)
+    {
+        return serializeAny(item, count);
+    }
+
+    virtual size_t serializeBool(bool* item, const size_t& count, const char*)
+    {
+        return serializeAny(item, count);
+    }
+
+    // sends anything not yet sent
+    virtual ~ChannelBinary();
+};
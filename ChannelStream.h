@@ -5,10 +5,11 @@ $Id: ChannelStream.h 2428 2012-08-14 15:33:13Z whoward $
 
 #pragma once
 
+#include <Serialize.h>
 #include <Stream.h>
 
 /** @brief Simple channel class that reads and write to a Stream. It serializes the raw data not translating it into strings, or xml or anything, just
- the raw internal representation.
+ the raw internal representation. Reading waits for data still on its way for as long as timeout_milliseconds, by default as long as it takes.
  */
 
 class ChannelStream: public Channel
@@ -16,10 +17,10 @@ class ChannelStream: public Channel
     Stream& _stream;
 
 public:
-    ChannelStream(const Channel::DIRECTION& direction, Stream& stream) :
+    ChannelStream(const Channel::DIRECTION& direction, Stream& stream, const int timeout_milliseconds = -1) :
         Channel(direction), _stream(stream)
     {
-
+	set_timeout_milliseconds(timeout_milliseconds);
     }
 
     virtual Text open(const char* package_name = NULL)
@@ -48,19 +49,16 @@ public:
         //int read_size(0);
         if (get_direction() == OUT)
         {
-            _stream.writeAll(sizeof(amount),
-                    reinterpret_cast<const char*> (&amount));
-            _stream.writeAll(sizeof(PRIMITIVE) * amount,
-                    reinterpret_cast<const char*> (object));
+            struct iovec frame[] = {
+                { &amount, sizeof(amount) },
+                { const_cast<char*> (reinterpret_cast<const char*> (object)), sizeof(PRIMITIVE) * amount }
+            };
+            _stream.writeAllVector(frame, 2); // length and payload in one go
         }
         else
         {
-            while (not _stream.readAll(sizeof(amount),
-                    const_cast<char*> (reinterpret_cast<const char*> (&amount))))
-                sleep(1);
-            while (not _stream.readAll(sizeof(PRIMITIVE) * amount,
-                    const_cast<char*> (reinterpret_cast<const char*> (object))))
-                sleep(1);
+            ReadSerialized(*this, _stream, &amount, sizeof(amount));
+            ReadSerialized(*this, _stream, object, sizeof(PRIMITIVE) * amount);
         }
 
         incrementOffset(sizeof(PRIMITIVE) * amount);
@@ -0,0 +1,127 @@
+/*
+Copyright 2009 by Walt Howard
+$Id: DatagramBatch.cc 2428 2012-08-14 15:33:13Z whoward $
+*/
+
+#include <DatagramBatch.h>
+#include <Misc.h>
+#include <cerrno>
+#include <cstring>
+
+DatagramBatch::DatagramBatch(const size_t capacity, const size_t datagram_size) :
+    _datagram_size(GREATER(datagram_size, static_cast<size_t>(1))), _slab(GREATER(capacity, static_cast<size_t>(1)) * _datagram_size),
+    _headers(GREATER(capacity, static_cast<size_t>(1))), _pieces(_headers.size()), _peers(_headers.size()), _datagrams(_headers.size()),
+    _size(0), _sent(0)
+{
+}
+
+bool DatagramBatch::add(const char* data, const size_t size, const sockaddr* peer, const socklen_t peer_length)
+{
+    // a batch that was received, or completely sent, starts over. A full one has room again.
+    if (_sent == _size and _sent)
+	clear();
+
+    if (_size == capacity() or size > _datagram_size or peer_length > sizeof(struct sockaddr_storage))
+	return false;
+
+    ::memcpy(slot(_size), data, size);
+
+    Datagram& datagram = _datagrams[_size];
+    datagram.data = slot(_size);
+    datagram.size = size;
+    datagram.truncated = false;
+    datagram.peer = NULL;
+    datagram.peer_length = 0;
+
+    if (peer and peer_length)
+    {
+	::memcpy(&_peers[_size], peer, peer_length);
+	datagram.peer = reinterpret_cast<const sockaddr*>(&_peers[_size]);
+	datagram.peer_length = peer_length;
+    }
+
+    ++_size;
+    return true;
+}
+
+int DatagramBatch::receive(const int fd)
+{
+    clear();
+
+    const size_t count = capacity();
+
+    for (size_t i = 0; i < count; ++i)
+    {
+	_pieces[i].iov_base = slot(i);
+	_pieces[i].iov_len = _datagram_size;
+
+	struct msghdr& header = _headers[i].msg_hdr;
+	::memset(&header, 0, sizeof(header));
+	header.msg_name = &_peers[i];
+	header.msg_namelen = sizeof(_peers[i]);
+	header.msg_iov = &_pieces[i];
+	header.msg_iovlen = 1;
+    }
+
+    int received = ::recvmmsg(fd, &_headers[0], count, MSG_DONTWAIT, NULL);
+
+    if (received == -1)
+	return (errno == EAGAIN or errno == EWOULDBLOCK) ? 0 : -1;
+
+    for (int i = 0; i < received; ++i)
+    {
+	const struct msghdr& header = _headers[i].msg_hdr;
+
+	Datagram& datagram = _datagrams[i];
+	datagram.data = slot(i);
+	datagram.size = LESSER(static_cast<size_t>(_headers[i].msg_len), _datagram_size);
+	datagram.truncated = header.msg_flags & MSG_TRUNC;
+	datagram.peer = header.msg_namelen ? reinterpret_cast<const sockaddr*>(&_peers[i]) : NULL;
+	datagram.peer_length = header.msg_namelen;
+    }
+
+    _size = received;
+    _sent = _size; // nothing here to send
+
+    return received;
+}
+
+int DatagramBatch::send(const int fd, const sockaddr* default_peer, const socklen_t default_peer_length)
+{
+    if (not pending())
+	return 0;
+
+    for (size_t i = _sent; i < _size; ++i)
+    {
+	Datagram& datagram = _datagrams[i];
+
+	_pieces[i].iov_base = const_cast<char*>(datagram.data);
+	_pieces[i].iov_len = datagram.size;
+
+	struct msghdr& header = _headers[i].msg_hdr;
+	::memset(&header, 0, sizeof(header));
+	header.msg_name = const_cast<sockaddr*>(datagram.peer ? datagram.peer : default_peer);
+	header.msg_namelen = datagram.peer ? datagram.peer_length : (default_peer ? default_peer_length : 0);
+	header.msg_iov = &_pieces[i];
+	header.msg_iovlen = 1;
+    }
+
+    int sent = ::sendmmsg(fd, &_headers[_sent], pending(), MSG_DONTWAIT);
+
+    if (sent == -1)
+	return (errno == EAGAIN or errno == EWOULDBLOCK) ? 0 : -1;
+
+    _sent += sent;
+
+    return sent;
+}
+
+size_t DatagramBatch::bytes(const size_t first, const size_t last) const
+{
+    size_t total = 0;
+
+    for (size_t i = first; i < last; ++i)
+	total += _datagrams[i].size;
+
+    return total;
+}
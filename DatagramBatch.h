@@ -0,0 +1,111 @@
+/*
+Copyright 2009 by Walt Howard
+$Id: DatagramBatch.h 2428 2012-08-14 15:33:13Z whoward $
+*/
+
+#pragma once
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <vector>
+#include <cstddef>
+
+/**
+   Up to capacity() datagrams, each with its peer address, moved in one recvmmsg or sendmmsg. The datagrams live in one slab
+   allocated up front, one slot of datagram_size bytes each, and operator[] hands out views of them, no copies.
+
+   Received: the views are good until the next receive or clear(). A datagram bigger than its slot is cut short and marked
+   truncated.
+
+   Sending: add() copies datagrams in. A send may not get all of them out; the rest stay pending() for the next one.
+
+   The datagram streams use these through readBatch() and writeBatch().
+*/
+class DatagramBatch
+{
+public:
+    struct Datagram
+    {
+	const char* data;
+	size_t size;
+	const sockaddr* peer; // NULL when sending to the socket's default destination
+	socklen_t peer_length;
+	bool truncated;
+    };
+
+private:
+    size_t _datagram_size;
+
+    std::vector<char> _slab;
+    std::vector<struct mmsghdr> _headers;
+    std::vector<struct iovec> _pieces;
+    std::vector<struct sockaddr_storage> _peers;
+    std::vector<Datagram> _datagrams;
+
+    size_t _size; // datagrams received, or added for sending
+    size_t _sent;
+
+    char* slot(const size_t i)
+    {
+	return &_slab[i * _datagram_size];
+    }
+
+public:
+    DatagramBatch(const size_t capacity = 64, const size_t datagram_size = 9216);
+
+    size_t capacity() const
+    {
+	return _datagrams.size();
+    }
+
+    size_t datagram_size() const
+    {
+	return _datagram_size;
+    }
+
+    size_t size() const
+    {
+	return _size;
+    }
+
+    bool empty() const
+    {
+	return not _size;
+    }
+
+    const Datagram& operator[](const size_t i) const
+    {
+	return _datagrams[i];
+    }
+
+    // added but not yet sent
+    size_t pending() const
+    {
+	return _size - _sent;
+    }
+
+    void clear()
+    {
+	_size = _sent = 0;
+    }
+
+    /** @brief  Copy a datagram in for sending.
+	@param  peer  where to, or NULL for the stream's default destination.
+	@return false if the batch is full or the datagram is bigger than a slot.
+    */
+    bool add(const char* data, const size_t size, const sockaddr* peer = NULL, const socklen_t peer_length = 0);
+
+    /** @brief  Replace the contents with whatever datagrams are waiting on fd, without waiting.
+	@return how many, 0 if none, or -1 with errno set.
+    */
+    int receive(const int fd);
+
+    /** @brief  Send what is pending, without waiting.
+	@param  default_peer  for datagrams added without a peer. NULL if the socket is connected.
+	@return how many went, or -1 with errno set.
+    */
+    int send(const int fd, const sockaddr* default_peer = NULL, const socklen_t default_peer_length = 0);
+
+    // total bytes in datagrams first through last - 1
+    size_t bytes(const size_t first, const size_t last) const;
+};
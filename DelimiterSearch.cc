@@ -0,0 +1,286 @@
+/*
+Copyright 2009 by Walt Howard
+$Id: DelimiterSearch.cc 2428 2012-08-14 15:33:13Z whoward $
+*/
+
+#include <DelimiterSearch.h>
+#include <Misc.h>
+#include <deque>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DELIMITER_SEARCH_SIMD 1
+#endif
+
+namespace {
+
+#ifdef DELIMITER_SEARCH_SIMD
+
+bool CpuHasAvx2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+const bool Avx2 = CpuHasAvx2();
+
+// Step through whole 16 byte blocks from p until one holds a byte equal to any of the first bytes. mask gets a bit for each such byte.
+const char* NextCandidates16(const char* p, const char* end, const unsigned char* first, const unsigned count, unsigned& mask)
+{
+    __m128i wanted[4];
+    for (unsigned i = 0; i < count; ++i)
+	wanted[i] = _mm_set1_epi8(first[i]);
+
+    for (; p + 16 <= end; p += 16)
+    {
+	__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+
+	for (unsigned i = 0; i < count; ++i)
+	    mask |= _mm_movemask_epi8(_mm_cmpeq_epi8(block, wanted[i]));
+
+	if (mask)
+	    return p;
+    }
+
+    return p;
+}
+
+// Same as above, 32 bytes at a time
+__attribute__((target("avx2")))
+const char* NextCandidates32(const char* p, const char* end, const unsigned char* first, const unsigned count, unsigned& mask)
+{
+    __m256i wanted[4];
+    for (unsigned i = 0; i < count; ++i)
+	wanted[i] = _mm256_set1_epi8(first[i]);
+
+    for (; p + 32 <= end; p += 32)
+    {
+	__m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+
+	for (unsigned i = 0; i < count; ++i)
+	    mask |= _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, wanted[i]));
+
+	if (mask)
+	    return p;
+    }
+
+    return p;
+}
+
+#endif
+
+}
+
+DelimiterSearch::DelimiterSearch() :
+    _longest(0), _first_byte_count(0), _use_automaton(false)
+{
+}
+
+bool DelimiterSearch::compile(const std::vector<const char*>& delimiters)
+{
+    if (delimiters.size() == _delimiters.size())
+    {
+	size_t i = 0;
+	while (i < delimiters.size() and _delimiters[i] == delimiters[i])
+	    ++i;
+
+	if (i == delimiters.size())
+	    return false;
+    }
+
+    _delimiters.assign(delimiters.begin(), delimiters.end());
+
+    _longest = 0;
+    _first_byte_count = 0;
+    size_t used = 0;
+
+    for (std::vector<std::string>::const_iterator d(_delimiters.begin()); d != _delimiters.end(); ++d)
+    {
+	if (d->empty())
+	    continue;
+
+	++used;
+	_longest = GREATER(_longest, d->size());
+
+	unsigned char first = (*d)[0];
+	if (_first_byte_count < MAX_FIRST_BYTES and not ::memchr(_first_bytes, first, _first_byte_count))
+	    _first_bytes[_first_byte_count++] = first;
+    }
+
+    _use_automaton = used > MAX_SIMD_DELIMITERS or _longest > MAX_SIMD_LENGTH;
+
+    _goto.clear();
+    _matches.clear();
+
+    if (_use_automaton)
+	buildAutomaton();
+
+    return true;
+}
+
+void DelimiterSearch::buildAutomaton()
+{
+    // the trie
+    _goto.assign(256, -1);
+    _matches.resize(1);
+
+    for (size_t which = 0; which < _delimiters.size(); ++which)
+    {
+	const std::string& d = _delimiters[which];
+
+	if (d.empty())
+	    continue;
+
+	int32_t state = 0;
+
+	for (std::string::const_iterator c(d.begin()); c != d.end(); ++c)
+	{
+	    int32_t& next = _goto[state * 256 + static_cast<unsigned char>(*c)];
+
+	    if (next == -1)
+	    {
+		next = _matches.size();
+		_matches.resize(_matches.size() + 1);
+		_goto.resize(_goto.size() + 256, -1);
+	    }
+
+	    state = _goto[state * 256 + static_cast<unsigned char>(*c)];
+	}
+
+	_matches[state].push_back(which);
+    }
+
+    // Breadth first, fill in the missing transitions from the failure states so the scan is one table lookup per byte,
+    // and give each state the matches of its failure state as well.
+    std::vector<int32_t> failure(_matches.size(), 0);
+    std::deque<int32_t> queue;
+
+    for (unsigned c = 0; c < 256; ++c)
+    {
+	if (_goto[c] == -1)
+	    _goto[c] = 0;
+	else
+	    queue.push_back(_goto[c]);
+    }
+
+    while (not queue.empty())
+    {
+	int32_t state = queue.front();
+	queue.pop_front();
+
+	const std::vector<unsigned>& inherited = _matches[failure[state]];
+	_matches[state].insert(_matches[state].end(), inherited.begin(), inherited.end());
+
+	for (unsigned c = 0; c < 256; ++c)
+	{
+	    int32_t& next = _goto[state * 256 + c];
+	    int32_t fallback = _goto[failure[state] * 256 + c];
+
+	    if (next == -1)
+		next = fallback;
+	    else
+	    {
+		failure[next] = fallback;
+		queue.push_back(next);
+	    }
+	}
+    }
+}
+
+const char* DelimiterSearch::verify(const char* candidate, const char* end, size_t& which) const
+{
+    const size_t available = end - candidate;
+
+    for (size_t i = 0; i < _delimiters.size(); ++i)
+    {
+	const std::string& d = _delimiters[i];
+
+	if (d.size() and d.size() <= available and d[0] == *candidate and not ::memcmp(candidate, d.data(), d.size()))
+	{
+	    which = i;
+	    return candidate;
+	}
+    }
+
+    return NULL;
+}
+
+const char* DelimiterSearch::findCandidates(const char* begin, const char* end, size_t& which) const
+{
+    const char* p = begin;
+
+    if (_first_byte_count == 1 and _longest == 1)
+    {
+	p = static_cast<const char*>(::memchr(p, _first_bytes[0], end - p));
+	return p ? verify(p, end, which) : NULL;
+    }
+
+#ifdef DELIMITER_SEARCH_SIMD
+    const unsigned width = Avx2 ? 32 : 16;
+
+    while (true)
+    {
+	unsigned mask = 0;
+
+	if (Avx2)
+	    p = NextCandidates32(p, end, _first_bytes, _first_byte_count, mask);
+	else
+	    p = NextCandidates16(p, end, _first_bytes, _first_byte_count, mask);
+
+	if (not mask)
+	    break;
+
+	for (; mask; mask &= mask - 1)
+	    if (const char* found = verify(p + __builtin_ctz(mask), end, which))
+		return found;
+
+	p += width;
+    }
+#endif
+
+    // whatever is left over, less than a block
+    for (; p < end; ++p)
+	if (::memchr(_first_bytes, static_cast<unsigned char>(*p), _first_byte_count))
+	    if (const char* found = verify(p, end, which))
+		return found;
+
+    return NULL;
+}
+
+const char* DelimiterSearch::findAutomaton(const char* begin, const char* end, size_t& which) const
+{
+    const char* best = NULL;
+    int32_t state = 0;
+
+    for (const char* p = begin; p < end; ++p)
+    {
+	// every match still to come would start after the best one found already
+	if (best and static_cast<size_t>(p - best) >= _longest)
+	    break;
+
+	state = _goto[state * 256 + static_cast<unsigned char>(*p)];
+
+	const std::vector<unsigned>& matches = _matches[state];
+
+	for (std::vector<unsigned>::const_iterator m(matches.begin()); m != matches.end(); ++m)
+	{
+	    const char* start = p + 1 - _delimiters[*m].size();
+
+	    if (not best or start < best or (start == best and *m < which))
+	    {
+		best = start;
+		which = *m;
+	    }
+	}
+    }
+
+    return best;
+}
+
+const char* DelimiterSearch::find(const char* begin, const char* end, size_t& which) const
+{
+    if (begin >= end or not _longest)
+	return NULL;
+
+    return _use_automaton ? findAutomaton(begin, end, which) : findCandidates(begin, end, which);
+}
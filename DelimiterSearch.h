@@ -0,0 +1,69 @@
+/*
+Copyright 2009 by Walt Howard
+$Id: DelimiterSearch.h 2428 2012-08-14 15:33:13Z whoward $
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/**
+   Finds the earliest occurrence of any of a set of delimiter strings in one pass over the data.
+
+   A few short delimiters (the usual "\n", "\r" case) are found by comparing whole blocks of data against every distinct
+   first byte at once with SSE2 (or AVX2 when the cpu has it) and verifying only the candidate positions. Many or long
+   delimiters are matched with an Aho-Corasick automaton instead. When two delimiters start at the same place the one
+   earlier in the list wins.
+*/
+class DelimiterSearch
+{
+    enum { MAX_SIMD_DELIMITERS = 4, MAX_SIMD_LENGTH = 8, MAX_FIRST_BYTES = 4 };
+
+    std::vector<std::string> _delimiters;
+
+    size_t _longest;
+
+    unsigned char _first_bytes[MAX_FIRST_BYTES];
+    unsigned _first_byte_count;
+
+    bool _use_automaton;
+
+    // Aho-Corasick: _goto has 256 entries per state, _matches lists the delimiters (by index) ending in each state.
+    std::vector<int32_t> _goto;
+    std::vector<std::vector<unsigned> > _matches;
+
+    void buildAutomaton();
+
+    const char* verify(const char* candidate, const char* end, size_t& which) const;
+
+    const char* findCandidates(const char* begin, const char* end, size_t& which) const;
+
+    const char* findAutomaton(const char* begin, const char* end, size_t& which) const;
+
+public:
+    DelimiterSearch();
+
+    /** @brief  Prepare to search for delimiters. Empty delimiters never match.
+	@return true if the set differs from the one previously compiled. Nothing is rebuilt when it is the same.
+    */
+    bool compile(const std::vector<const char*>& delimiters);
+
+    /** @brief  Find the earliest delimiter in [begin, end).
+	@param  which  set to the index, in the compiled list, of the delimiter found.
+	@return where the delimiter starts, or NULL if there is no complete delimiter in the range.
+    */
+    const char* find(const char* begin, const char* end, size_t& which) const;
+
+    // length of the longest delimiter. A partial match can hang over the end of a search by one less than this.
+    size_t get_longest() const
+    {
+	return _longest;
+    }
+
+    const std::string& delimiter(const size_t which) const
+    {
+	return _delimiters[which];
+    }
+};
@@ -5,6 +5,8 @@ $Id: DiskFileStream.cc 2424 2012-08-13 19:07:09Z whoward $
 
 #include <DiskFileStream.h>
 #include <Enhanced.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 Text DiskFileStream::OpenPath;
 
@@ -80,6 +82,46 @@ void DiskFileStream::open(const char* filename, const char* options)
     }
 
     set_descriptors(descriptor, descriptor);
+
+    if (not (openflags & (O_CREAT|O_WRONLY|O_RDWR|O_TRUNC|O_APPEND)) and strcasestr(get_option_string().c_str(), "MMAP"))
+	mapFile(descriptor);
+}
+
+void DiskFileStream::mapFile(const int descriptor)
+{
+    struct stat status;
+    THROW_ON_ERROR(::fstat(descriptor, &status));
+
+    if (not S_ISREG(status.st_mode) or status.st_size == 0)
+	return;
+
+    const size_t length = status.st_size;
+
+    // The buffer has to end in a null. Past the end of the file, the rest of its last page reads as zeros, but a file that ends on a
+    // page boundary has no rest: it goes over one more byte of zeros, anonymous memory reserved here along with the file's pages.
+    void* reserved = ::mmap(NULL, length + 1, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (reserved == MAP_FAILED)
+	throw Exception(LOCATION, "Reserving %zu bytes to map \"%s\"", length + 1, get_resource().c_str());
+
+    void* data = ::mmap(reserved, length, PROT_READ, MAP_PRIVATE | MAP_FIXED, descriptor, 0);
+
+    if (data == MAP_FAILED)
+    {
+	Exception error(LOCATION, "Mapping \"%s\" (%zu bytes)", get_resource().c_str(), length);
+	::munmap(reserved, length + 1);
+	throw error;
+    }
+
+    // it will be gone through front to back, so read ahead hard and drop pages behind
+    ::madvise(data, length, MADV_SEQUENTIAL);
+    ::madvise(data, length, MADV_WILLNEED);
+
+    // the descriptor goes on from the end of what was mapped
+    THROW_ON_ERROR(::lseek(descriptor, length, SEEK_SET));
+
+    mapBuffer(static_cast<char*>(data), length);
+    increment_read(length);
 }
 
 // Disk files are ALWAYS read and write ready
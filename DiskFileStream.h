@@ -10,11 +10,18 @@ $Id: DiskFileStream.h 2424 2012-08-13 19:07:09Z whoward $
 
 /**
  Use a disk based file for a stream.
+
+ With the MMAP option a file opened for reading only is mmap()ed instead of read, and the mapping is the read buffer: delimiter
+ searches, peeks and readAll() work straight off the file's pages with nothing copied in. The stream is the file as it was when it
+ was opened, and is at eof() once the mapping has been consumed.
  */
 class DiskFileStream: public FileDescriptorStream
 {
     static Text OpenPath;
 
+    // map the file open on descriptor into the read buffer. Does nothing for an empty file or anything that isn't a regular file.
+    void mapFile(const int descriptor);
+
 public:
     GETSET_STATIC(Text, OpenPath);
 
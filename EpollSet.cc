@@ -0,0 +1,223 @@
+/*
+Copyright 2009 by Walt Howard
+$Id: EpollSet.cc 2428 2012-08-14 15:33:13Z whoward $
+*/
+
+#include <EpollSet.h>
+#include <Exception.h>
+#include <Misc.h>
+#include <sys/epoll.h>
+#include <sched.h>
+#include <unistd.h>
+#include <time.h>
+#include <atomic>
+
+namespace {
+
+/*
+  Descriptors closed by any thread, so every thread's sets can drop them. A closer reserves a slot, fills it, then publishes it in
+  order. A set that falls more than a whole log behind starts over from scratch.
+*/
+const uint64_t CloseLogSize = 4096;
+std::atomic<uint64_t> CloseReserved(0);
+std::atomic<uint64_t> ClosePublished(0);
+std::atomic<int> CloseLog[CloseLogSize];
+
+long MillisecondsSince(const timespec& start)
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+}
+
+}
+
+EpollSet::EpollSet(const INTEREST interest) :
+    _interest(interest), _epoll(-1), _request(0), _forgotten(ClosePublished.load())
+{
+    THROW_ON_ERROR(_epoll = ::epoll_create1(EPOLL_CLOEXEC));
+}
+
+EpollSet& EpollSet::ForThread(const INTEREST interest)
+{
+    static thread_local EpollSet readers(READ);
+    static thread_local EpollSet writers(WRITE);
+
+    return interest == READ ? readers : writers;
+}
+
+void EpollSet::Forget(const int fd)
+{
+    if (fd < 0)
+	return;
+
+    const uint64_t slot = CloseReserved.fetch_add(1);
+    CloseLog[slot % CloseLogSize].store(fd);
+
+    // wait for any closer ahead of us to publish first
+    uint64_t expected = slot;
+    while (not ClosePublished.compare_exchange_weak(expected, slot + 1))
+    {
+	expected = slot;
+	sched_yield();
+    }
+}
+
+int EpollSet::Close(const int fd)
+{
+    Forget(fd);
+    return ::close(fd);
+}
+
+void EpollSet::reset()
+{
+    ::close(_epoll);
+    THROW_ON_ERROR(_epoll = ::epoll_create1(EPOLL_CLOEXEC));
+    _entries.clear();
+}
+
+void EpollSet::catchUp()
+{
+    const uint64_t published = ClosePublished.load();
+
+    if (probable(published == _forgotten))
+	return;
+
+    for (uint64_t i = _forgotten; i < published and published - _forgotten <= CloseLogSize; ++i)
+    {
+	const int fd = CloseLog[i % CloseLogSize].load();
+
+	if (fd >= 0 and static_cast<size_t>(fd) < _entries.size())
+	    _entries[fd] = Entry(); // the kernel already took it out of the epoll set when it was closed
+    }
+
+    // if closers lapped us while we were reading the log, some of what we read was overwritten
+    if (CloseReserved.load() - _forgotten > CloseLogSize)
+	reset();
+
+    _forgotten = published;
+}
+
+int EpollSet::control(const int operation, const int fd, const bool interested)
+{
+    struct epoll_event event;
+    event.events = interested ? (_interest == READ ? EPOLLIN | EPOLLRDHUP : EPOLLOUT) : 0;
+    event.data.u64 = fd;
+
+    return ::epoll_ctl(_epoll, operation, fd, &event) == -1 ? errno : 0;
+}
+
+void EpollSet::wait(const unsigned timeout_milliseconds, const int* fds, const size_t count, std::vector<size_t>& readies)
+{
+    catchUp();
+
+    if (improbable(++_request == 0)) // 0 means "never asked about"
+	++_request;
+
+    const size_t already = readies.size();
+
+    _repeats.clear();
+
+    for (size_t i = 0; i < count; ++i)
+    {
+	const int fd = fds[i];
+
+	if (static_cast<size_t>(fd) >= _entries.size())
+	    _entries.resize(fd + 1);
+
+	Entry& entry = _entries[fd];
+
+	if (improbable(entry._request == _request)) // listed more than once. It is reported at every position it is listed at.
+	{
+	    _repeats.push_back(std::make_pair(entry._index, i));
+	    continue;
+	}
+
+	entry._request = _request;
+	entry._index = i;
+
+	if (probable(entry._state == ARMED))
+	    continue;
+
+	if (entry._state == ALWAYS_READY)
+	{
+	    readies.push_back(i);
+	    continue;
+	}
+
+	int error = ENOENT;
+
+	if (entry._state == DISARMED)
+	    error = control(EPOLL_CTL_MOD, fd, true);
+
+	if (error == ENOENT) // not in the set (any more)
+	    error = control(EPOLL_CTL_ADD, fd, true);
+
+	if (error == EEXIST) // in the set after all, though we had it as unregistered or disarmed
+	    error = control(EPOLL_CTL_MOD, fd, true);
+
+	if (probable(not error))
+	    entry._state = ARMED;
+	else if (error == EPERM) // regular file, always ready just like select() says
+	{
+	    entry._state = ALWAYS_READY;
+	    readies.push_back(i);
+	}
+	else
+	{
+	    errno = error;
+	    throw Exception(LOCATION, "EpollSet: can't watch file descriptor %d", fd);
+	}
+    }
+
+    timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    long wait_milliseconds = readies.size() > already ? 0 : timeout_milliseconds;
+
+    for (;;)
+    {
+	struct epoll_event events[64];
+
+	int ready = ::epoll_wait(_epoll, events, sizeof(events) / sizeof(events[0]), wait_milliseconds);
+
+	if (ready == -1 and errno != EINTR)
+	    throw Exception(LOCATION, "%s", FullErrorInfo().c_str());
+
+	for (int e = 0; e < ready; ++e)
+	{
+	    const int fd = events[e].data.u64;
+	    Entry& entry = _entries[fd];
+
+	    if (entry._request == _request and entry._state == ARMED)
+		readies.push_back(entry._index);
+	    else
+	    {
+		// nobody is asking about this one right now. Stop it waking us up until somebody does.
+		control(EPOLL_CTL_MOD, fd, false);
+		entry._state = DISARMED;
+	    }
+	}
+
+	if (readies.size() > already or ready == 0 or not wait_milliseconds)
+	    break;
+
+	// woken by descriptors nobody asked about, or a signal. Wait out the rest.
+	wait_milliseconds = timeout_milliseconds - MillisecondsSince(start);
+
+	if (wait_milliseconds <= 0)
+	    break;
+    }
+
+    const size_t found = readies.size();
+
+    for (size_t r = 0; r < _repeats.size(); ++r)
+	for (size_t i = already; i < found; ++i)
+	    if (readies[i] == _repeats[r].first)
+		readies.push_back(_repeats[r].second);
+}
+
+EpollSet::~EpollSet()
+{
+    ::close(_epoll);
+}
@@ -0,0 +1,94 @@
+/*
+Copyright 2009 by Walt Howard
+$Id: EpollSet.h 2428 2012-08-14 15:33:13Z whoward $
+*/
+
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <stdint.h>
+#include <cstddef>
+
+/**
+   Readiness backend for AreDescriptorsReadReady() and friends. Each thread keeps one epoll set for reading and one for writing
+   and they live across calls, so checking the same descriptors over and over costs a single epoll_wait and no epoll_ctl at all.
+   Descriptor numbers past FD_SETSIZE are fine.
+
+   Descriptors stay registered after a check. If one becomes ready while nobody is asking about it, its interest is switched off
+   until it is asked about again, so it can't keep waking up waits on other descriptors. Regular files can't be put in an epoll
+   set; like select(), they are always ready.
+
+   The set must be told when a descriptor is closed, BEFORE it is closed, so it doesn't mistake a new descriptor that gets the
+   same number for the old one: an entry it believes is armed is trusted without asking the kernel, so waits on the newcomer would
+   never be woken. Close() does both in the right order, and FileDescriptorStream, Socket and ExecStream close through it. So must
+   anything else that closes a descriptor that has been waited on.
+*/
+class EpollSet
+{
+public:
+    enum INTEREST
+    {
+	READ, WRITE
+    };
+
+private:
+    enum STATE
+    {
+	UNREGISTERED, ARMED, DISARMED, ALWAYS_READY
+    };
+
+    struct Entry
+    {
+	uint8_t _state;
+	uint32_t _request; // the wait() call that last asked about this descriptor
+	uint32_t _index; // and its position in that call's list
+
+	Entry() : _state(UNREGISTERED), _request(0), _index(0)
+	{
+	}
+    };
+
+    INTEREST _interest;
+
+    int _epoll;
+
+    uint32_t _request;
+
+    uint64_t _forgotten; // how far through the global close log this set has caught up
+
+    std::vector<Entry> _entries; // indexed by descriptor
+
+    std::vector<std::pair<size_t, size_t> > _repeats; // in the current wait(): where a descriptor was first listed, and where again
+
+    void catchUp();
+
+    // epoll_ctl, returning 0 or the errno
+    int control(const int operation, const int fd, const bool interested);
+
+    void reset();
+
+    EpollSet(const INTEREST interest);
+
+    EpollSet(const EpollSet&);
+
+public:
+    // The calling thread's set for the given interest.
+    static EpollSet& ForThread(const INTEREST interest);
+
+    /** @brief  Wait until at least one of fds is ready, or the timeout passes, whichever is first.
+	@param  readies  the positions in fds of the ready descriptors are appended to this. The caller maps them back to whatever
+	        stands behind each descriptor, without any searching. A descriptor listed twice is reported at both positions.
+
+	Every descriptor in fds that has been closed since it was last waited on must have been closed through Close() or Forget().
+    */
+    void wait(const unsigned timeout_milliseconds, const int* fds, const size_t count, std::vector<size_t>& readies);
+
+    // Call just before fd is closed. Once it is closed its number can be handed out again, by another thread even.
+    static void Forget(const int fd);
+
+    // Forget() fd, then close it. Returns what ::close() does.
+    static int Close(const int fd);
+
+    ~EpollSet();
+};
@@ -102,6 +102,17 @@ void ExecStream::open(const char* commandline, const char* options)
     if (pid != 0)
     {
 	_child_pid = pid;
+
+	// The child's ends belong to the child. Holding them open here means the child's output never reaches end of file
+	// and nothing watching it ever hears the child hang up.
+	if (child_in[0] > -1)
+	    ::close(child_in[0]);
+	if (child_out[1] > -1)
+	    ::close(child_out[1]);
+	if (child_err[1] > -1)
+	    ::close(child_err[1]);
+
+	_error_from_child = child_err[0];
         FileDescriptorStream::set_descriptors(child_out[0], child_in[1]);
 	return;
     }
@@ -175,6 +186,12 @@ void ExecStream::close()
     // of this object.
     FileDescriptorStream::close();
 
+    if (_error_from_child > -1)
+    {
+	EpollSet::Close(_error_from_child);
+	_error_from_child = -2;
+    }
+
     // If we didn't double fork, we are responsible for cleaning up the zombie. Do this just in case we
     // didn't do it elsewhere. Ignore the error as it might have already been done. We are just making sure.
 
@@ -199,5 +216,12 @@ bool ExecStream::eof()
 
 ExecStream::~ExecStream()
 {
-    close();
+    try
+    {
+	close();
+    }
+    catch (const std::exception& ex)
+    {
+	// a destructor can't throw. The descriptors are closed regardless.
+    }
 }
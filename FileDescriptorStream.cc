@@ -4,107 +4,99 @@ $Id: FileDescriptorStream.cc 2428 2012-08-14 15:33:13Z whoward $
 */
 
 #include <sys/time.h>
+#include <climits>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
 #include <FileDescriptorStream.h>
+#include <IoUring.h>
+#include <TimerWheel.h>
 #include <Enhanced.h>
 #include <MiniConfig.h>
 #include <Misc.h>
 
-/**
- Use select() on an std::vector of file descriptors.
- */
-std::vector<int> AreDescriptorsReadReady(const unsigned timeout_milliseconds, const std::vector<int>& fds_to_check)
+namespace {
+
+// io_uring has no vectored reads and writes into pool buffers, so the pieces go one at a time. -1 only if nothing went.
+ssize_t UringReadVector(IoUringFile& file, const struct iovec* vector, const int count)
 {
-    for (;;)
+    ssize_t total = 0;
+
+    for (int i = 0; i < count; ++i)
     {
-	std::vector<int> readies; // will contain descriptors that are readable
+	ssize_t rval = file.read(static_cast<char*>(vector[i].iov_base), vector[i].iov_len);
 
-	fd_set read_set;
-	FD_ZERO(&read_set);
+	if (rval == -1)
+	    return (total and errno == EAGAIN) ? total : -1;
 
-	int highest_descriptor(-1);
+	total += rval;
 
-	for (std::vector<int>::const_iterator fd(fds_to_check.begin()); fd != fds_to_check.end(); ++fd)
-        {
-	    if (*fd < 0)
-		throw Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "AreDescriptorsReadReady: Invalid file descriptor:%d", *fd);
+	if (static_cast<size_t>(rval) < vector[i].iov_len)
+	    break;
+    }
 
-	    FD_SET(*fd, &read_set);
-            highest_descriptor = highest_descriptor > *fd ? highest_descriptor : *fd;
-        }
+    return total;
+}
 
-        // Convert milliseconds into seconds and remaining micro seconds.
-        struct timeval timeout = { timeout_milliseconds / 1000, (timeout_milliseconds % 1000) * 1000 };
+ssize_t UringWriteVector(IoUringFile& file, const struct iovec* vector, const int count)
+{
+    ssize_t total = 0;
 
-        switch (::select(highest_descriptor + 1, &read_set, NULL, NULL, &timeout))
-        {
-	case -1:
-	    if (errno != EINTR)
-		throw(Exception(LOCATION, "%s", FullErrorInfo().c_str()));
-	    break; // try again
+    for (int i = 0; i < count; ++i)
+    {
+	ssize_t rval = file.write(static_cast<const char*>(vector[i].iov_base), vector[i].iov_len);
 
-	case 0:
-	    return readies; // readies of course is empty here. We're returning an empty vector.
+	if (rval == -1)
+	    return (total and errno == EAGAIN) ? total : -1;
 
-	default:
-	{
-	    // If some of the descriptors are read ready, fill the return vector with them.
-	    for (std::vector<int>::const_iterator fd(fds_to_check.begin()); fd != fds_to_check.end(); ++fd)
-	    {
-		if (FD_ISSET(*fd, &read_set))
-		    readies.push_back(*fd);
-	    }
+	total += rval;
 
-	    return readies;
-	}
-	}
+	if (static_cast<size_t>(rval) < vector[i].iov_len)
+	    break;
     }
+
+    return total;
 }
 
-std::vector<int> AreDescriptorsWriteReady(const unsigned timeout_milliseconds, const std::vector<int>& fds_to_check)
+}
+
+std::vector<size_t> ReadyDescriptorPositions(const unsigned timeout_milliseconds, const std::vector<int>& fds_to_check, const EpollSet::INTEREST interest)
 {
-    for (;;)
-    {
-        std::vector<int> readies; // will contain descriptors that are readable
+    for (std::vector<int>::const_iterator fd(fds_to_check.begin()); fd != fds_to_check.end(); ++fd)
+	if (*fd < 0)
+	    throw Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "%s: Invalid file descriptor:%d, did you not call open()?",
+			    interest == EpollSet::READ ? "AreDescriptorsReadReady" : "AreDescriptorsWriteReady", *fd);
 
-        fd_set write_set;
-        FD_ZERO(&write_set);
+    std::vector<size_t> readies;
 
-        int highest_descriptor(-1);
+    if (not fds_to_check.empty())
+	EpollSet::ForThread(interest).wait(timeout_milliseconds, &fds_to_check[0], fds_to_check.size(), readies);
 
-        for (std::vector<int>::const_iterator fd(fds_to_check.begin()); fd != fds_to_check.end(); ++fd)
-        {
-	    if (*fd < 0)
-		throw Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "AreDescriptorsWriteRead: Invalid file descriptor:%d, did you not call open()?", *fd);
+    return readies;
+}
 
-	    FD_SET(*fd, &write_set);
-	    highest_descriptor = highest_descriptor > *fd ? highest_descriptor : *fd;
-        }
+/**
+ Check an std::vector of file descriptors for readability
+ */
+std::vector<int> AreDescriptorsReadReady(const unsigned timeout_milliseconds, const std::vector<int>& fds_to_check)
+{
+    std::vector<size_t> positions = ReadyDescriptorPositions(timeout_milliseconds, fds_to_check, EpollSet::READ);
 
-        // Convert milliseconds into seconds and remaining micro seconds.
-        struct timeval timeout = { timeout_milliseconds / 1000, (timeout_milliseconds % 1000) * 1000 };
+    std::vector<int> readies; // will contain descriptors that are readable
+    for (std::vector<size_t>::const_iterator i(positions.begin()); i != positions.end(); ++i)
+	readies.push_back(fds_to_check[*i]);
 
-        switch (::select(highest_descriptor + 1, NULL, &write_set, NULL, &timeout))
-        {
-	case -1:
-	    if (errno != EINTR)
-		throw(Exception(LOCATION, "%s", FullErrorInfo().c_str()));
-	    break; // try again
+    return readies;
+}
 
-	case 0:
-	    return readies; // readies of course is empty here. We're returning an empty vector.
+std::vector<int> AreDescriptorsWriteReady(const unsigned timeout_milliseconds, const std::vector<int>& fds_to_check)
+{
+    std::vector<size_t> positions = ReadyDescriptorPositions(timeout_milliseconds, fds_to_check, EpollSet::WRITE);
 
-	default:
-	{
-	    // If some of the descriptors are read ready, fill the return vector with them.
-	    for (std::vector<int>::const_iterator fd(fds_to_check.begin()); fd != fds_to_check.end(); ++fd)
-	    {
-		if (FD_ISSET(*fd, &write_set))
-		    readies.push_back(*fd);
-	    }
-	    return readies;
-	}
-        }
-    }
+    std::vector<int> readies; // will contain descriptors that are writable
+    for (std::vector<size_t>::const_iterator i(positions.begin()); i != positions.end(); ++i)
+	readies.push_back(fds_to_check[*i]);
+
+    return readies;
 }
 
 size_t FileDescriptorStream::read(const size_t max_read, char* destination)
@@ -121,7 +113,7 @@ size_t FileDescriptorStream::read(const size_t max_read, char* destination)
     if (improbable(get_read_fd() == -2))
 	open();
 
-    int rval = ::read(get_read_fd(), destination, max_read);
+    int rval = Fd->_uring ? Fd->_uring->read(destination, max_read) : ::read(get_read_fd(), destination, max_read);
 
     if (rval == 0)
     {
@@ -144,13 +136,71 @@ size_t FileDescriptorStream::read(const size_t max_read, char* destination)
     return rval;
 }
 
+size_t FileDescriptorStream::readVector(const struct iovec* vector, const int count)
+{
+    if (improbable(get_read_fd() == -2))
+	open();
+
+    ssize_t rval = Fd->_uring ? UringReadVector(*Fd->_uring, vector, count) : ::readv(get_read_fd(), vector, LESSER(count, IOV_MAX));
+
+    if (rval == 0)
+    {
+        set_fd_eof(true);
+        return 0;
+    }
+
+    if (rval == -1)
+    {
+        if (errno != EAGAIN)
+        {
+	    set_fd_eof(true);
+            throw(Exception(LOCATION, "FileDescriptorStream::readVector error:"));
+        }
+        else
+            return 0;
+    }
+
+    increment_read(rval);
+    return rval;
+}
+
 size_t FileDescriptorStream::write(const size_t amount,
 				   const char* const source)
 {
     if (improbable(get_write_fd() == -2))
 	open();
 
-    int rval = ::write(get_write_fd(), source, amount);
+    // a direct write must not overtake what is waiting in the write buffer, or in the output queue if it can't all go yet
+    if (improbable(pendingOutput()))
+    {
+	flush();
+
+	if (pendingOutput())
+	    return 0;
+    }
+
+    int rval = Fd->_uring ? Fd->_uring->write(source, amount) : ::write(get_write_fd(), source, amount);
+    if (improbable(rval == -1))
+    {
+        if (improbable(errno != EAGAIN))
+        {
+            set_fd_eof(true);
+            throw(Exception(LOCATION, "Error writing file descriptor %d to %s", get_write_fd(), get_resource().c_str()));
+        }
+        else
+            return 0;
+    }
+
+    increment_written(rval);
+    return rval;
+}
+
+size_t FileDescriptorStream::writeVector(const struct iovec* vector, const int count)
+{
+    if (improbable(get_write_fd() == -2))
+	open();
+
+    ssize_t rval = Fd->_uring ? UringWriteVector(*Fd->_uring, vector, count) : ::writev(get_write_fd(), vector, LESSER(count, IOV_MAX));
     if (improbable(rval == -1))
     {
         if (improbable(errno != EAGAIN))
@@ -174,25 +224,24 @@ Text FileDescriptorStream::readToDelimiterStringWithTimeout(
     if (not rval.empty())
         return rval;
 
-    timeval start;
-    gettimeofday(&start, NULL);
+    const Deadline deadline(GREATER(timeout_millisecs, 0L));
+
+    // wait on the descriptor itself. isReadReady() would say yes straight away to the part already buffered.
+    std::vector<FileDescriptorStream*> waiting(1, this);
 
     do
     {
-        isReadReady(timeout_millisecs); // wait here for new data.
+        if (get_fd_eof())
+            break;
+
+        AreReadReady(deadline.remaining(), waiting); // wait here for new data.
 
         Text rval = readToDelimiterString(delimiter, options);
         if (not rval.empty())
             return rval;
 
         // if we got data, but not enough to fill our request, wait for any remaining part of the timeout
-
-        timeval now;
-        gettimeofday(&now, NULL);
-
-        timeout_millisecs -= (((now.tv_sec - start.tv_sec) * 1000000)
-			      + (now.tv_usec - start.tv_usec)) / 1000;
-    } while (timeout_millisecs > 0);
+    } while (not deadline.expired());
 
     throw(Exception(LOCATION, "Timeout reading to delimiter"));
 }
@@ -201,6 +250,13 @@ bool FileDescriptorStream::isReadReady(const unsigned timeout_milliseconds)
 {
     if (eof())
 	throw Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "isReadReady() called on eof Stream");
+    if (pendingOutput())
+	flush();
+
+    // the reply we may be waiting for could be to something still queued for io_uring
+    if (Fd->_uring)
+	IoUring::SubmitQueued();
+
     std::vector<FileDescriptorStream*> streams;
     streams.push_back(this);
     return hasBuffered() or not AreReadReady(timeout_milliseconds, streams).empty();
@@ -215,6 +271,17 @@ bool FileDescriptorStream::isWriteReady(const unsigned timeout_milliseconds)
     return not AreWriteReady(timeout_milliseconds, streams).empty();
 }
 
+void FileDescriptorStream::flush()
+{
+    Stream::flush();
+
+    if (Fd->_uring and Fd->_uring->flush() == -1)
+    {
+	set_fd_eof(true);
+	throw(Exception(LOCATION, "Error writing file descriptor %d to %s", get_write_fd(), get_resource().c_str()));
+    }
+}
+
 bool FileDescriptorStream::eof()
 {
     return get_fd_eof() and not hasBuffered();
@@ -298,9 +365,13 @@ void FileDescriptorStream::setDefaults()
 	if (-1 == ::fcntl(get_read_fd(), F_SETFL, O_NONBLOCK))
 	    throw(Exception(LOCATION, "set nonblocking on read handle:%d", get_read_fd()));
 
-    if ( get_write_fd() > -1)
+    if (get_write_fd() > -1 and get_write_fd() != get_read_fd()) // sockets are both, and one fcntl does it
 	if (-1 == ::fcntl(get_write_fd(), F_SETFL, O_NONBLOCK))
 	    throw(Exception(LOCATION, "set nonblocking on write handle:%d", get_write_fd()));
+
+    // URING: read and write through the thread's io_uring, when the kernel has one
+    if (not Fd->_uring and (get_read_fd() > -1 or get_write_fd() > -1) and strcasestr(get_option_string().c_str(), "URING"))
+	Fd->_uring.reset(IoUringFile::Attach(get_read_fd(), get_write_fd()));
 }
 
 void FileDescriptorStream::set_descriptors(const int read_descriptor, const int write_descriptor)
@@ -360,7 +431,205 @@ void FileDescriptorStream::close()
 {
     // don't actually close the descriptor if other people are using it.
     if (Fd.use_count() == 1)
+    {
+	try
+	{
+	    if ((pendingOutput() or Fd->_uring) and get_write_fd() >= 0 and not get_fd_eof())
+	    {
+		// what is waiting to go out goes as long as the other end keeps taking it, for up to LINGER in all. It gets one try even with none.
+		const Deadline deadline(linger());
+
+		while (pendingOutput() and isWriteReady(deadline.remaining()))
+		{
+		    flushWithin(deadline.remaining());
+
+		    if (deadline.expired())
+			break;
+		}
+
+		if (Fd->_uring and Fd->_uring->flush(deadline.remaining()) == -1)
+		{
+		    if (errno == ETIMEDOUT)
+			throw Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "Writes to %s not finished within %u milliseconds of closing",
+					get_resource().c_str(), linger());
+
+		    set_fd_eof(true);
+		    throw(Exception(LOCATION, "Error writing file descriptor %d to %s", get_write_fd(), get_resource().c_str()));
+		}
+
+		if (pendingOutput())
+		    throw Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "%zu bytes not taken by %s within %u milliseconds of closing",
+				    pendingOutput(), get_resource().c_str(), linger());
+	    }
+	}
+	catch (const std::exception& ex)
+	{
+	    Fd->Close();
+	    Stream::close();
+	    throw;
+	}
+
 	Fd->Close();
+
+	Stream::close();
+    }
+}
+
+namespace {
+
+mode_t TypeOf(const int fd, mode_t& cached)
+{
+    if (not cached)
+    {
+	struct stat status;
+	if (::fstat(fd, &status) == 0)
+	    cached = status.st_mode & S_IFMT;
+    }
+
+    return cached;
+}
+
+// the kernel can't do this one for these descriptors, as opposed to something having gone wrong
+bool Unsupported(const int error)
+{
+    return error == EINVAL or error == ENOSYS or error == EXDEV or error == EOPNOTSUPP or error == EBADF;
+}
+
+}
+
+size_t FileDescriptorStream::transferTo(Stream& out, const size_t max)
+{
+    // the system calls below move nothing for nothing and return 0, which would pass for the end of the file
+    if (improbable(not max))
+	return 0;
+
+    FileDescriptorStream* destination = dynamic_cast<FileDescriptorStream*>(&out);
+
+    // what is buffered here has to go first, and io_uring streams have their own buffers
+    if (not destination or destination == this or (buffered() and not Fd->_piped) or Fd->_uring or destination->Fd->_uring)
+	return Stream::transferTo(out, max);
+
+    if (destination->pendingOutput())
+    {
+	destination->flush();
+
+	if (destination->pendingOutput())
+	    return 0;
+    }
+
+    if (improbable(get_read_fd() == -2))
+	open();
+
+    if (improbable(destination->get_write_fd() == -2))
+	destination->open();
+
+    const int from = get_read_fd();
+    const int to = destination->get_write_fd();
+    const unsigned flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+
+    ssize_t moved = -1;
+
+    if (Fd->_piped)
+    {
+	// left over from last time. Nothing new is taken in until it is gone.
+	moved = ::splice(Fd->_pipe[0], NULL, to, NULL, Fd->_piped, flags);
+
+	if (moved == -1)
+	{
+	    if (errno != EAGAIN)
+	    {
+		destination->set_fd_eof(true);
+		throw(Exception(LOCATION, "Error splicing to %s", destination->get_resource().c_str()));
+	    }
+
+	    return 0;
+	}
+
+	Fd->_piped -= moved;
+	destination->increment_written(moved);
+
+	return moved;
+    }
+
+    const mode_t source_type = TypeOf(from, Fd->_read_type);
+    const mode_t destination_type = TypeOf(to, destination->Fd->_write_type);
+
+    if (source_type == S_IFREG)
+    {
+	if (destination_type == S_IFREG)
+	    moved = ::copy_file_range(from, NULL, to, NULL, max, 0);
+
+	if (moved == -1)
+	    moved = ::sendfile(to, from, NULL, max);
+    }
+    else if (source_type == S_IFIFO or destination_type == S_IFIFO)
+	moved = ::splice(from, NULL, to, NULL, max, flags);
+    else
+    {
+	if (Fd->_pipe[0] == -1)
+	    THROW_ON_ERROR(::pipe2(Fd->_pipe, O_NONBLOCK | O_CLOEXEC));
+
+	ssize_t taken = ::splice(from, NULL, Fd->_pipe[1], NULL, max, flags);
+
+	if (taken == -1 and Unsupported(errno))
+	    return Stream::transferTo(out, max);
+
+	if (taken == -1 and errno != EAGAIN)
+	{
+	    set_fd_eof(true);
+	    throw(Exception(LOCATION, "Error splicing from %s", get_resource().c_str()));
+	}
+
+	if (taken == 0)
+	    set_fd_eof(true);
+
+	if (taken <= 0)
+	    return 0;
+
+	increment_read(taken);
+	Fd->_piped = taken;
+
+	moved = ::splice(Fd->_pipe[0], NULL, to, NULL, Fd->_piped, flags);
+
+	if (moved == -1)
+	{
+	    if (errno != EAGAIN)
+	    {
+		destination->set_fd_eof(true);
+		throw(Exception(LOCATION, "Error splicing to %s", destination->get_resource().c_str()));
+	    }
+
+	    return 0;
+	}
+
+	Fd->_piped -= moved;
+	destination->increment_written(moved);
+
+	return moved;
+    }
+
+    if (moved == -1)
+    {
+	if (errno == EAGAIN)
+	    return 0;
+
+	if (Unsupported(errno))
+	    return Stream::transferTo(out, max);
+
+	set_fd_eof(true);
+	throw(Exception(LOCATION, "Error transferring from %s to %s", get_resource().c_str(), destination->get_resource().c_str()));
+    }
+
+    if (moved == 0)
+    {
+	set_fd_eof(true); // the end of the file, or the other end hung up
+	return 0;
+    }
+
+    increment_read(moved);
+    destination->increment_written(moved);
+
+    return moved;
 }
 
 FileDescriptorStream* FileDescriptorStream::CopyNew() const
@@ -371,7 +640,14 @@ FileDescriptorStream* FileDescriptorStream::CopyNew() const
 
 FileDescriptorStream::~FileDescriptorStream()
 {
-    close();
+    try
+    {
+	close();
+    }
+    catch (const std::exception& ex)
+    {
+	// the descriptor is closed regardless. Output still in the write buffer is lost.
+    }
 }
 
 MiniConfig FileDescriptorStream::parseTextualOptions(const char* textual_options)
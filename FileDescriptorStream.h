@@ -9,75 +9,64 @@ $Id: FileDescriptorStream.h 2428 2012-08-14 15:33:13Z whoward $
 #include <boost/shared_ptr.hpp>
 #include <vector>
 #include <map>
+#include <EpollSet.h>
 #include <fcntl.h>
 #include <Misc.h>
 #include <MiniConfig.h>
 
+class IoUringFile;
+
+/*
+  The readiness checks below remember the descriptors they are given between calls (see EpollSet). A descriptor passed to one of them
+  must be closed with EpollSet::Close(), or EpollSet::Forget() just before ::close(): otherwise a new descriptor that gets the same
+  number is taken for the old one, and never reported ready. Streams do this themselves.
+*/
 std::vector<int> AreDescriptorsReadReady(const unsigned timeout_milliseconds, const std::vector<int>& fds_to_check);
 
 std::vector<int> AreDescriptorsWriteReady(const unsigned timeout_milliseconds, const std::vector<int>& fds_to_check);
 
+/**
+ Positions in fds_to_check of the descriptors that are ready for the interest, waiting up to the timeout for at least one. The thread's
+ EpollSet does the work, and a descriptor listed more than once is reported at each of its positions. The templates below use the positions to get straight back to their streams, with no reverse lookups.
+ */
+std::vector<size_t> ReadyDescriptorPositions(const unsigned timeout_milliseconds, const std::vector<int>& fds_to_check, const EpollSet::INTEREST interest);
+
 template<typename STREAM> std::vector<STREAM*> AreReadReady(const unsigned timeout_milliseconds, std::vector<STREAM*>& streams_to_check)
 {
     std::vector<int> check_these; // We will need to get the actual descriptors of all the Streams into a vector.
 
-    std::map<int, STREAM*> reverse_map; // used later to quickly build a vector of STREAM*s that are read ready.
-
     for (typename std::vector<STREAM*>::const_iterator i(streams_to_check.begin()); i != streams_to_check.end(); ++i)
-    {
         check_these.push_back((*i)->get_read_fd());
-        reverse_map[(*i)->get_read_fd()] = *i;
-    }
 
-    std::vector<int> readies = AreDescriptorsReadReady(timeout_milliseconds, check_these);
+    std::vector<size_t> readies = ReadyDescriptorPositions(timeout_milliseconds, check_these, EpollSet::READ);
 
     std::vector<STREAM*> results;
 
-    results.clear();
-
-    for (std::vector<int>::const_iterator i(readies.begin()); i != readies.end(); ++i)
-        results.push_back(reverse_map[*i]);
+    for (std::vector<size_t>::const_iterator i(readies.begin()); i != readies.end(); ++i)
+        results.push_back(streams_to_check[*i]);
 
     return results;
 }
 
 template<typename STREAM, template<typename > class STL_CONTAINER> std::vector<STREAM*> AreReadReady(const unsigned timeout_milliseconds, STL_CONTAINER<STREAM*>& streams_to_check)
 {
-    std::vector<int> check_these; // We will need to get the actual descriptors of all the Streams into a vector.
-    std::map<int, STREAM*> reverse_map; // used later to quickly build a vector of STREAM*s that are read ready.
-
-    for (typename STL_CONTAINER<STREAM>::const_iterator i(streams_to_check.begin()); i != streams_to_check.end(); ++i)
-    {
-        check_these.push_back((*i)->get_read_fd());
-        reverse_map[(*i)->get_read_fd()] = &(*i);
-    }
-
-    std::vector<int> readies = AreDescriptorsReadReady(timeout_milliseconds, check_these);
-
-    std::vector<STREAM*> results;
-
-    for (std::vector<int>::const_iterator i(readies.begin()); i != readies.end(); ++i)
-        results.push_back(reverse_map[*i]);
-
-    return results;
+    std::vector<STREAM*> streams(streams_to_check.begin(), streams_to_check.end());
+    return AreReadReady(timeout_milliseconds, streams);
 }
 
 template<typename STREAM> std::vector<STREAM*> AreWriteReady(const unsigned timeout_milliseconds, std::vector<STREAM*>& streams_to_check)
 {
     std::vector<int> check_these; // We will need to get the actual descriptors of all the Streams into a vector.
-    std::map<int, STREAM*> reverse_map; // used later to quickly build a vector of STREAM*s that are read ready.
+
     for (typename std::vector<STREAM*>::const_iterator i(streams_to_check.begin()); i != streams_to_check.end(); ++i)
-    {
         check_these.push_back((*i)->get_write_fd());
-        reverse_map[(*i)->get_write_fd()] = *i;
-    }
 
-    std::vector<int> readies = AreDescriptorsWriteReady(timeout_milliseconds, check_these);
+    std::vector<size_t> readies = ReadyDescriptorPositions(timeout_milliseconds, check_these, EpollSet::WRITE);
 
     std::vector<STREAM*> results;
 
-    for (std::vector<int>::const_iterator i(readies.begin()); i != readies.end(); ++i)
-        results.push_back(reverse_map[*i]);
+    for (std::vector<size_t>::const_iterator i(readies.begin()); i != readies.end(); ++i)
+        results.push_back(streams_to_check[*i]);
 
     return results;
 }
@@ -86,29 +75,17 @@ template<typename STREAM, template<typename > class STL_CONTAINER> std::vector<
         STREAM*> AreWriteReady(const unsigned timeout_milliseconds,
         STL_CONTAINER<STREAM>& streams_to_check)
 {
-    std::vector<int> check_these; // We will need to get the actual descriptors of all the Streams into a vector.
-    std::map<int, STREAM*> reverse_map; // used later to quickly build a vector of STREAM*s that are read ready.
+    std::vector<STREAM*> streams;
 
-    for (typename STL_CONTAINER<STREAM>::const_iterator i(
-            streams_to_check.begin()); i != streams_to_check.end(); ++i)
+    for (typename STL_CONTAINER<STREAM>::iterator i(streams_to_check.begin()); i != streams_to_check.end(); ++i)
     {
-        if ((*i)->eof()) // skip eof descriptors
+        if (i->eof()) // skip eof descriptors
             continue;
 
-        check_these.push_back(i->get_descriptor());
-        reverse_map[i->get_descriptor()] = &(*i);
+        streams.push_back(&(*i));
     }
 
-    std::vector<int> readies = AreDescriptorsWriteReady(timeout_milliseconds,
-            check_these);
-
-    std::vector<STREAM*> results;
-
-    for (std::vector<int>::const_iterator i(readies.begin()); i
-            != readies.end(); ++i)
-        results.push_back(reverse_map[*i]);
-
-    return results;
+    return AreWriteReady(timeout_milliseconds, streams);
 }
 
 /* Does select return read ready OR is there still data in the local buffer? */
@@ -140,24 +117,8 @@ template<typename STREAM, template<typename > class STL_CONTAINER> std::vector<
     if (not results.empty())
         return results;
 
-    std::vector<int> check_these; // We will need to get the actual descriptors of all the Streams into a vector.
-    std::map<int, STREAM*> reverse_map; // used later to quickly build a vector of STREAM*s that are read ready.
-    for (typename STL_CONTAINER<STREAM*>::iterator i(streams_to_check.begin()); i
-            != streams_to_check.end(); ++i)
-    {
-        // If this fails to compile, your STREAM class doesn't have this. This function only works in the FileDescriptorStream hierarchy
-        check_these.push_back((*i)->get_descriptor());
-        reverse_map[(*i)->get_descriptor()] = *i;
-    }
-
-    std::vector<int> readies = AreDescriptorsReadReady(timeout_milliseconds,
-            check_these);
-
-    for (std::vector<int>::const_iterator i(readies.begin()); i
-            != readies.end(); ++i)
-        results.push_back(reverse_map[*i]);
-
-    return results;
+    std::vector<STREAM*> streams(streams_to_check.begin(), streams_to_check.end());
+    return AreReadReady(timeout_milliseconds, streams);
 }
 
 /* Does select return read ready OR is there still data in the local buffer? */
@@ -178,6 +139,9 @@ template<typename STREAM, template<typename > class STL_CONTAINER> std::vector<
 
  This class is rather brain dead. It only supports functionality that is broadly associated with file descriptors. Your in your subclasses, your
  "open" function should call set_descriptor() when you get back a file descriptor, socket, pipe of whatever.
+
+ With the URING option, reads and writes go through the thread's io_uring instead of ::read and ::write (see IoUringFile), or
+ through ::read and ::write as usual if the kernel doesn't have it.
  */
 
 
@@ -191,20 +155,41 @@ class FileDescriptorStream: public Stream
 	unsigned long long _written;
 	unsigned long long _read;
 	bool _eof;
+	boost::shared_ptr<IoUringFile> _uring; // set when the URING option is given and the kernel has io_uring
+
+	// for transferTo()
+	mode_t _read_type; // S_IFMT of the descriptors, 0 until looked up
+	mode_t _write_type;
+	int _pipe[2]; // splice() goes through this when neither end is a pipe. -1 until needed.
+	size_t _piped; // read into _pipe and not yet written out of it
 
 	FileDescriptor()
-	    : _write_descriptor(-2), _read_descriptor(-2), _written(0), _read(0), _eof(false)
+	    : _write_descriptor(-2), _read_descriptor(-2), _written(0), _read(0), _eof(false), _read_type(0), _write_type(0), _piped(0)
 	{
+	    _pipe[0] = _pipe[1] = -1;
 	}
 
 	void Close()
 	{
+	    _uring.reset(); // whatever it still has outstanding has to finish before the descriptors go
+
+	    if (_pipe[0] != -1)
+	    {
+		EpollSet::Close(_pipe[0]);
+		EpollSet::Close(_pipe[1]);
+		_pipe[0] = _pipe[1] = -1;
+		_piped = 0;
+	    }
+
+	    _read_type = _write_type = 0;
+
 	    // don't close standard handles
 	    if (_read_descriptor == 0 or _write_descriptor <= 2)
 		return;
 
-	    ::close(_read_descriptor);
-	    ::close(_write_descriptor);
+	    EpollSet::Close(_read_descriptor);
+	    if (_write_descriptor != _read_descriptor)
+		EpollSet::Close(_write_descriptor);
 	    _write_descriptor = -2;
 	    _read_descriptor = -2;
 	}
@@ -272,16 +257,41 @@ public:
 
     virtual size_t write(const size_t amount, const char* const source);
 
+    // one writev()
+    virtual size_t writeVector(const struct iovec* vector, const int count);
+
+    // one readv()
+    virtual size_t readVector(const struct iovec* vector, const int count);
+
     virtual bool isReadReady(const unsigned timeout_milliseconds = 0);
 
     virtual bool isWriteReady(const unsigned timeout_milliseconds = 0);
 
+    // also waits for writes handed to io_uring (URING option) to finish
+    virtual void flush();
+
+    /** @brief  Stream::transferTo() done in the kernel when out is a FileDescriptorStream too: copy_file_range between regular
+	files, sendfile from a regular file to anything else, splice from a socket or pipe. Between two sockets the data goes
+	through a pipe kept for the purpose, and what out could not take yet stays there, to go first next time (see
+	pendingTransfer()). Falls back to Stream::transferTo() for other streams, io_uring streams, while data is buffered here, and
+	when the kernel can't do it for these descriptors.
+    */
+    virtual size_t transferTo(Stream& out, const size_t max);
+
+    // taken from this stream by transferTo() but not yet written out
+    size_t pendingTransfer() const
+    {
+	return Fd->_piped;
+    }
+
     virtual FileDescriptorStream* CopyNew() const;
 
     Text readToDelimiterStringWithTimeout(const char* delimiter, const Stream::OPTIONS options, long timeout_millisecs);
 
     Text readToDelimiterStrings(const DelimiterList& delimiters, const Stream::OPTIONS options);
 
+    // What is still waiting to go out gets up to linger() milliseconds in all, and close() throws if it isn't taken.
+    // The descriptor and the read buffer are let go either way.
     virtual void close();
 
     virtual ~FileDescriptorStream();
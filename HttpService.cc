@@ -1,4 +1,5 @@
 #include <HttpService.h>
+#include <TimerWheel.h>
 
 int HttpService::Authenticate()
 {
@@ -40,48 +41,98 @@ int HttpService::Authenticate()
     return 0;
 }
 
+namespace {
+
+// Next space separated word at or after p, moving p past it.
+Stream::View NextWord(const char*& p, const char* end)
+{
+    while (p < end and *p == ' ')
+	++p;
+
+    const char* word = p;
+
+    while (p < end and *p != ' ')
+	++p;
+
+    return Stream::View(word, p - word);
+}
+
+// The next CRLF terminated line at or after p, moving p past it. The last line need not be terminated.
+Stream::View NextLine(const char*& p, const char* end)
+{
+    const char* line = p;
+    const char* crlf = static_cast<const char*>(::memmem(p, end - p, "\r\n", 2));
+
+    p = crlf ? crlf + 2 : end;
+
+    return Stream::View(line, (crlf ? crlf : end) - line);
+}
+
+}
+
 void HttpService::GetHttp()
 {
-    if (not ServiceStream->isReadReady(5000))
-	throw Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "Http data not coming in for 5 seconds, giving up");
+    // the whole request head has READ_TIMEOUT milliseconds to arrive, however many pieces it comes in
+    const Text& timeout = ServiceStream->get_options().getValue("READ_TIMEOUT");
+    const unsigned milliseconds = timeout.empty() ? 5000 : ::strtoul(timeout.c_str(), NULL, 0);
+    const Deadline deadline(milliseconds);
+
+    // wait on the socket itself. The stream is read ready as long as part of a request sits in its buffer.
+    std::vector<SocketStream*> waiting(1, ServiceStream.get());
 
-    Text request = ServiceStream->readToDelimiterString("\r\n");
-    if (request.empty())
+    // The request line and headers are tokenized where they sit in the stream's buffer and consumed all at once afterwards.
+    Stream::View head = ServiceStream->peekToDelimiter("\r\n\r\n");
+    while (not head)
     {
-	if (not ServiceStream->isReadReady(5000))
-	    throw Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "Http request not coming in for 5 seconds, giving up");
+	if (ServiceStream->get_fd_eof())
+	    throw Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "Client %s went away before sending a whole request", ServiceStream->PeerAddress().c_str());
 
-	request = ServiceStream->readToDelimiterString("\r\n");
-	if (request.empty())
-	    throw Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "Client %s too slow. No request after 5 seconds", ServiceStream->PeerAddress().c_str());
+	if (deadline.expired() or AreReadReady(deadline.remaining(), waiting).empty())
+	    throw Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "Client %s too slow. No request after %u milliseconds", ServiceStream->PeerAddress().c_str(), milliseconds);
 
+	head = ServiceStream->peekToDelimiter("\r\n\r\n");
     }
 
-    Text headers = ServiceStream->readToDelimiterString("\r\n\r\n");
-    if (request.empty())
-    {
-	if (not ServiceStream->isReadReady(5000))
-	    throw Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "Http headers not coming in for 5 seconds, giving up");
+    const char* p = head.data;
+    const char* end = head.data + head.size;
+
+    Stream::View request = NextLine(p, end);
 
-	headers = ServiceStream->readToDelimiterString("\r\n\r\n");
-	if (headers.empty())
-	    throw Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "Client %s too slow. No headers after 5 seconds", ServiceStream->PeerAddress().c_str());
+    const char* word = request.data;
+    const char* request_end = request.data + request.size;
+    NextWord(word, request_end); // type
+    Stream::View document = NextWord(word, request_end);
+
+    if (const char* query = static_cast<const char*>(::memchr(document.data, '?', document.size)))
+    {
+	Queries = TEXTMAP(Text(query + 1, document.data + document.size - query - 1).c_str(), "=", "&");
+	document.size = query - document.data;
     }
 
-    char type[2048] = "";
-    char document[2048] = "";
-    char protocol[2048] = "";
-    sscanf(request.c_str(), "%2047s %2047s %2047s", type, document, protocol);
+    Document = document.text();
+    Request = request.text();
 
-    if (char* query = strchr(document, '?'))
+    while (p < end)
     {
-	*query++ = '\0';
-	Queries = TEXTMAP(query, "=", "&");
+	Stream::View line = NextLine(p, end);
+	const char* colon = static_cast<const char*>(::memchr(line.data, ':', line.size));
+
+	if (not colon)
+	    continue;
+
+	const char* value = colon + 1;
+	const char* value_end = line.data + line.size;
+
+	while (value < value_end and (*value == ' ' or *value == '\t'))
+	    ++value;
+
+	while (value_end > value and (value_end[-1] == ' ' or value_end[-1] == '\t'))
+	    --value_end;
+
+	RequestHeaders[Text(line.data, colon - line.data)] = Text(value, value_end - value);
     }
 
-    Document = document;
-    Request = request;
-    RequestHeaders = TEXTMAP(headers.c_str(), ": ", "\r\n");
+    ServiceStream->consume(head.extent);
 }
 
 
@@ -109,27 +160,24 @@ void HttpService::open(SocketStream* stream, const char* address, const char* op
     ServiceStream->open();
 }
 
-size_t HttpService::prewrite(const Text& str)
-{
-    int rval = ServiceStream->write(str.size(), str.c_str());
-    if (improbable(rval < str.size()))
-    {
-	throw(Exception(LOCATION, "Error replying to Http client:%s", ServiceStream->PeerAddress().c_str()));
-    }
-    else
-	return 0;
-
-    return rval;
-}
-
 size_t HttpService::write(const size_t amount, const char* const source)
 {
     if (not ResponseHeadersWritten)
     {
 	ResponseHeadersWritten = true;
-	prewrite(StringPrintf(0, "HTTP/1.1 %d\r\n", ResponseCode));
-	prewrite(JoinMap(ResponseHeaders, ": ", "\r\n"));
-	prewrite("\r\n\r\n");
+	Text status = StringPrintf(0, "HTTP/1.1 %d\r\n", ResponseCode);
+	Text headers = JoinMap(ResponseHeaders, ": ", "\r\n");
+
+	// status, headers and the first of the body go out together
+	struct iovec response[] = {
+	    { const_cast<char*>(status.data()), status.size() },
+	    { const_cast<char*>(headers.data()), headers.size() },
+	    { const_cast<char*>("\r\n\r\n"), 4 },
+	    { const_cast<char*>(source), amount }
+	};
+
+	ServiceStream->writeAllVector(response, 4);
+	return amount;
     }
 
     return ServiceStream->write(amount, source);
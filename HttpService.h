@@ -24,8 +24,6 @@ class HttpService
     // Get the HTTP headers and other info.
     void GetHttp();
 
-    size_t prewrite(const Text& str);
-
     SocketStreamPtr ServiceStream;
 
 public:
@@ -0,0 +1,585 @@
+/*
+Copyright 2009 by Walt Howard
+$Id: IoUring.cc 2428 2012-08-14 15:33:13Z whoward $
+*/
+
+#include <IoUring.h>
+#include <Exception.h>
+#include <Misc.h>
+#include <TimerWheel.h>
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cstring>
+#include <algorithm>
+
+namespace {
+
+thread_local IoUring* ThisThread = NULL;
+
+// user_data with this bit set is not a Request: a poll linked ahead of one (the Request's address with the bit set), or a cancel
+const uint64_t NOT_A_REQUEST = 1;
+
+}
+
+IoUring::IoUring() :
+    _ring(-1), _sq_map(MAP_FAILED), _sq_map_size(0), _cq_map(MAP_FAILED), _cq_map_size(0), _sqes(NULL), _sqes_size(0),
+    _buffers(NULL), _registered(false), _unsubmitted(0)
+{
+    if (setup())
+	ThisThread = this;
+    else
+	teardown();
+}
+
+bool IoUring::setup()
+{
+    struct io_uring_params params;
+    ::memset(&params, 0, sizeof(params));
+
+    _ring = ::syscall(__NR_io_uring_setup, ENTRIES, &params);
+
+    if (_ring < 0)
+	return false;
+
+    // reads and writes at the descriptor's current position, like ::read and ::write (linux 5.6)
+    if (not (params.features & IORING_FEAT_RW_CUR_POS))
+	return false;
+
+    _sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    _cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+	_sq_map_size = _cq_map_size = GREATER(_sq_map_size, _cq_map_size);
+
+    _sq_map = ::mmap(NULL, _sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_SQ_RING);
+    if (_sq_map == MAP_FAILED)
+	return false;
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+	_cq_map = _sq_map;
+    else
+    {
+	_cq_map = ::mmap(NULL, _cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_CQ_RING);
+	if (_cq_map == MAP_FAILED)
+	    return false;
+    }
+
+    _sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes = ::mmap(NULL, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+	return false;
+    _sqes = static_cast<struct io_uring_sqe*>(sqes);
+
+    char* sq = static_cast<char*>(_sq_map);
+    _sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    _sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    _sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    _sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    _sq_entries = params.sq_entries;
+
+    char* cq = static_cast<char*>(_cq_map);
+    _cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    _cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    _cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    _cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    void* buffers = ::mmap(NULL, static_cast<size_t>(BUFFERS) * BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers == MAP_FAILED)
+	return false;
+    _buffers = static_cast<char*>(buffers);
+
+    struct iovec pool[BUFFERS];
+    for (int i = 0; i < BUFFERS; ++i)
+    {
+	pool[i].iov_base = buffer(i);
+	pool[i].iov_len = BUFFER_SIZE;
+    }
+
+    _registered = ::syscall(__NR_io_uring_register, _ring, IORING_REGISTER_BUFFERS, pool, BUFFERS) == 0;
+
+    for (int i = BUFFERS - 1; i >= 0; --i)
+	_free.push_back(i);
+
+    return true;
+}
+
+void IoUring::teardown()
+{
+    if (_buffers)
+	::munmap(_buffers, static_cast<size_t>(BUFFERS) * BUFFER_SIZE);
+    if (_sqes)
+	::munmap(_sqes, _sqes_size);
+    if (_cq_map != MAP_FAILED and _cq_map != _sq_map)
+	::munmap(_cq_map, _cq_map_size);
+    if (_sq_map != MAP_FAILED)
+	::munmap(_sq_map, _sq_map_size);
+    if (_ring >= 0)
+	::close(_ring); // unregisters the buffers too
+
+    _buffers = NULL;
+    _sqes = NULL;
+    _cq_map = _sq_map = MAP_FAILED;
+    _ring = -1;
+}
+
+IoUring* IoUring::ForThread()
+{
+    static thread_local IoUring ring;
+    return ring._ring >= 0 ? &ring : NULL;
+}
+
+void IoUring::SubmitQueued()
+{
+    if (ThisThread)
+	ThisThread->submit();
+}
+
+int IoUring::acquire()
+{
+    if (_free.empty())
+	return -1;
+
+    int buffer = _free.back();
+    _free.pop_back();
+    return buffer;
+}
+
+void IoUring::release(const int buffer)
+{
+    if (buffer >= 0)
+	_free.push_back(buffer);
+}
+
+void IoUring::queue(Request& request)
+{
+    request._state = Request::QUEUED;
+    _queued.push_back(&request);
+}
+
+void IoUring::enter(const unsigned min_complete)
+{
+    if (not _unsubmitted and not min_complete)
+	return;
+
+    for (;;)
+    {
+	int rval = ::syscall(__NR_io_uring_enter, _ring, _unsubmitted, min_complete, min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+
+	if (rval >= 0)
+	{
+	    _unsubmitted -= rval;
+	    return;
+	}
+
+	if (errno == EINTR)
+	    continue;
+
+	if (errno == EAGAIN or errno == EBUSY) // the completion queue is full. Make room.
+	{
+	    reap();
+	    continue;
+	}
+
+	throw Exception(LOCATION, "io_uring_enter");
+    }
+}
+
+void IoUring::reap()
+{
+    unsigned head = *_cq_head;
+    const unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; ++head)
+    {
+	const struct io_uring_cqe& completion = _cqes[head & *_cq_mask];
+
+	if (completion.user_data & NOT_A_REQUEST) // what became of the request is in its own completion
+	    continue;
+
+	Request* request = reinterpret_cast<Request*>(completion.user_data);
+	request->_result = completion.res;
+	request->_state = Request::DONE;
+    }
+
+    __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+}
+
+struct io_uring_sqe& IoUring::take()
+{
+    if (*_sq_tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) == _sq_entries) // full. Pass what is there along first.
+	enter(0);
+
+    struct io_uring_sqe& entry = _sqes[*_sq_tail & *_sq_mask];
+    ::memset(&entry, 0, sizeof(entry));
+    return entry;
+}
+
+void IoUring::push()
+{
+    const unsigned tail = *_sq_tail;
+    const unsigned index = tail & *_sq_mask;
+
+    _sq_array[index] = index;
+    __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    ++_unsubmitted;
+}
+
+void IoUring::submit()
+{
+    for (std::vector<Request*>::iterator r(_queued.begin()); r != _queued.end(); ++r)
+    {
+	Request& request = **r;
+
+	const bool write = request._opcode == IORING_OP_WRITE;
+
+	if (request._poll_first)
+	{
+	    // a link can't be split across two enters, so both entries go in together
+	    if (_sq_entries - (*_sq_tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE)) < 2)
+		enter(0);
+
+	    struct io_uring_sqe& poll = take();
+	    poll.opcode = IORING_OP_POLL_ADD;
+	    poll.fd = request._fd;
+	    poll.poll32_events = write ? POLLOUT : POLLIN;
+	    poll.flags = IOSQE_IO_LINK; // the request goes when the poll fires
+	    poll.user_data = reinterpret_cast<uint64_t>(&request) | NOT_A_REQUEST;
+	    push();
+
+	    request._poll_first = false;
+	}
+
+	struct io_uring_sqe& entry = take();
+
+	entry.opcode = _registered ? (write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED) : request._opcode;
+	entry.fd = request._fd;
+	entry.addr = reinterpret_cast<uint64_t>(buffer(request._buffer));
+	entry.len = request._length;
+	entry.off = static_cast<uint64_t>(-1); // current position
+	entry.rw_flags = request._flags;
+	entry.buf_index = request._buffer;
+	entry.user_data = reinterpret_cast<uint64_t>(&request);
+	push();
+
+	request._state = Request::IN_FLIGHT;
+    }
+
+    _queued.clear();
+
+    enter(0);
+    reap();
+}
+
+bool IoUring::complete(Request& request, const int timeout_milliseconds)
+{
+    const Deadline deadline(GREATER(timeout_milliseconds, 0));
+
+    while (request._state != Request::DONE)
+    {
+	if (request._state == Request::QUEUED)
+	    submit();
+	else if (request._state == Request::IN_FLIGHT and timeout_milliseconds < 0)
+	{
+	    enter(1);
+	    reap();
+	}
+	else if (request._state == Request::IN_FLIGHT)
+	{
+	    enter(0);
+
+	    // the ring's descriptor is readable when there are completions to reap
+	    struct pollfd ring = { _ring, POLLIN, 0 };
+	    const int ready = ::poll(&ring, 1, deadline.remaining());
+
+	    reap();
+
+	    if (ready == 0)
+		return request._state == Request::DONE;
+	}
+	else
+	    throw Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "IoUring: waiting for a request that was never queued");
+    }
+
+    return true;
+}
+
+void IoUring::cancel(Request& request)
+{
+    if (request._state == Request::QUEUED)
+	_queued.erase(std::find(_queued.begin(), _queued.end(), &request));
+    else if (request._state == Request::IN_FLIGHT)
+    {
+	// It may be waiting on a poll for as long as the other end likes. Call off the poll and the request, then wait for the
+	// kernel to be done with the buffer.
+	const uint64_t targets[] = { reinterpret_cast<uint64_t>(&request) | NOT_A_REQUEST, reinterpret_cast<uint64_t>(&request) };
+
+	for (size_t i = 0; i < sizeof(targets) / sizeof(targets[0]); ++i)
+	{
+	    struct io_uring_sqe& entry = take();
+	    entry.opcode = IORING_OP_ASYNC_CANCEL;
+	    entry.fd = -1;
+	    entry.addr = targets[i];
+	    entry.user_data = NOT_A_REQUEST;
+	    push();
+	}
+
+	complete(request);
+    }
+
+    release(request._buffer);
+    request._buffer = -1;
+    request._poll_first = false;
+    request._state = Request::IDLE;
+}
+
+IoUring::~IoUring()
+{
+    if (ThisThread == this)
+	ThisThread = NULL;
+
+    teardown();
+}
+
+IoUringFile::IoUringFile(IoUring& ring, const int read_fd, const int write_fd) :
+    _ring(ring), _read_fd(read_fd), _write_fd(write_fd), _regular(false), _read_ahead(false), _current(0), _taken(0)
+{
+    struct stat status;
+    const int fd = read_fd >= 0 ? read_fd : write_fd;
+
+    if (::fstat(fd, &status) == 0 and S_ISREG(status.st_mode))
+    {
+	_regular = true;
+
+	// Reading ahead moves the file position past what the caller has seen, which only matters if it is going to write.
+	_read_ahead = read_fd >= 0 and (::fcntl(read_fd, F_GETFL) & O_ACCMODE) == O_RDONLY;
+    }
+}
+
+IoUringFile* IoUringFile::Attach(const int read_fd, const int write_fd)
+{
+    IoUring* ring = IoUring::ForThread();
+
+    if (not ring or (read_fd < 0 and write_fd < 0))
+	return NULL;
+
+    return new IoUringFile(*ring, read_fd, write_fd);
+}
+
+void IoUringFile::startRead(IoUring::Request& request)
+{
+    request._buffer = _ring.acquire();
+
+    if (request._buffer == -1)
+	return;
+
+    request._opcode = IORING_OP_READ;
+    request._fd = _read_fd;
+    request._length = IoUring::BUFFER_SIZE;
+    request._flags = _regular ? 0 : RWF_NOWAIT; // a socket or pipe with nothing in it says so, instead of waiting
+
+    _ring.queue(request);
+}
+
+ssize_t IoUringFile::read(char* destination, const size_t max_read)
+{
+    if (not max_read)
+	return 0;
+
+    // a file has one position for reading and writing, so what was written has to land first
+    if (_regular and _write._state != IoUring::Request::IDLE and flush() == -1)
+	return -1;
+
+    IoUring::Request& request = _reads[_current];
+
+    if (request._state == IoUring::Request::IDLE)
+    {
+	startRead(request);
+
+	if (request._buffer == -1) // the pool is used up
+	    return ::read(_read_fd, destination, max_read);
+
+	// Unless reading ahead, only read what the caller can take. Anything held back here would be invisible to readiness checks
+	// on a socket, and would move a file's position past where the caller's next write should go.
+	if (not _read_ahead)
+	    request._length = LESSER(max_read, static_cast<size_t>(IoUring::BUFFER_SIZE));
+    }
+
+    _ring.complete(request);
+
+    const int result = request._result;
+
+    if (result <= 0) // end of file, or an error (EAGAIN included)
+    {
+	_ring.release(request._buffer);
+	request._buffer = -1;
+	request._state = IoUring::Request::IDLE;
+	_taken = 0;
+
+	if (result == 0)
+	    return 0;
+
+	errno = -result;
+	return -1;
+    }
+
+    // a full chunk in means there's probably more. Get it coming now.
+    IoUring::Request& next = _reads[_current ^ 1];
+    if (_read_ahead and not _taken and next._state == IoUring::Request::IDLE and static_cast<unsigned>(result) == request._length)
+    {
+	startRead(next);
+	_ring.submit();
+    }
+
+    const size_t amount = LESSER(max_read, result - _taken);
+    ::memcpy(destination, _ring.buffer(request._buffer) + _taken, amount);
+    _taken += amount;
+
+    if (_taken == static_cast<size_t>(result))
+    {
+	_ring.release(request._buffer);
+	request._buffer = -1;
+	request._state = IoUring::Request::IDLE;
+	_taken = 0;
+	_current ^= 1;
+    }
+
+    return amount;
+}
+
+int IoUringFile::settleWrite()
+{
+    const int result = _write._result;
+
+    if (result == -EAGAIN or result == -EINTR)
+    {
+	// full: this time the kernel waits for room before trying again
+	_write._poll_first = result == -EAGAIN;
+	_ring.queue(_write);
+	return 0;
+    }
+
+    if (result < 0)
+    {
+	_ring.release(_write._buffer);
+	_write._buffer = -1;
+	_write._state = IoUring::Request::IDLE;
+	errno = -result;
+	return -1;
+    }
+
+    if (static_cast<unsigned>(result) < _write._length) // partly written. The rest goes again.
+    {
+	char* data = _ring.buffer(_write._buffer);
+	::memmove(data, data + result, _write._length - result);
+	_write._length -= result;
+	_write._poll_first = not _regular; // a socket or pipe that took part of it is full
+	_ring.queue(_write);
+	return 0;
+    }
+
+    _ring.release(_write._buffer);
+    _write._buffer = -1;
+    _write._state = IoUring::Request::IDLE;
+    return 0;
+}
+
+ssize_t IoUringFile::write(const char* source, const size_t amount)
+{
+    if (not amount)
+	return 0;
+
+    // what is in the kernel's hands can't be added to, and what follows it has to wait its turn
+    if (_write._state == IoUring::Request::IN_FLIGHT)
+    {
+	if (_regular)
+	    _ring.complete(_write);
+	else
+	    _ring.submit();
+    }
+
+    if (_write._state == IoUring::Request::IN_FLIGHT)
+    {
+	errno = EAGAIN;
+	return -1;
+    }
+
+    if (_write._state == IoUring::Request::DONE and settleWrite() == -1)
+	return -1;
+
+    if (_write._state == IoUring::Request::IDLE)
+    {
+	_write._buffer = _ring.acquire();
+
+	if (_write._buffer == -1) // the pool is used up, and nothing of ours is outstanding to be overtaken
+	    return ::write(_write_fd, source, amount);
+
+	_write._opcode = IORING_OP_WRITE;
+	_write._fd = _write_fd;
+	_write._length = 0;
+	_write._flags = 0;
+
+	_ring.queue(_write);
+    }
+
+    const size_t room = IoUring::BUFFER_SIZE - _write._length;
+
+    if (not room)
+    {
+	_ring.submit();
+	errno = EAGAIN;
+	return -1;
+    }
+
+    const size_t taken = LESSER(room, amount);
+    ::memcpy(_ring.buffer(_write._buffer) + _write._length, source, taken);
+    _write._length += taken;
+
+    if (_write._length == IoUring::BUFFER_SIZE) // nothing more fits, so no reason to hold it
+	_ring.submit();
+
+    return taken;
+}
+
+int IoUringFile::flush(const int timeout_milliseconds)
+{
+    const Deadline deadline(GREATER(timeout_milliseconds, 0));
+
+    while (_write._state != IoUring::Request::IDLE)
+    {
+	if (_write._state == IoUring::Request::DONE)
+	{
+	    if (settleWrite() == -1)
+		return -1;
+	}
+	else if (not _ring.complete(_write, timeout_milliseconds < 0 ? -1 : static_cast<int>(deadline.remaining())))
+	{
+	    errno = ETIMEDOUT;
+	    return -1;
+	}
+    }
+
+    return 0;
+}
+
+IoUringFile::~IoUringFile()
+{
+    try
+    {
+	flush(_regular ? -1 : 0); // a disk finishes. The other end of a socket might never read.
+    }
+    catch (const std::exception& ex)
+    {
+	// the buffers are taken back below regardless
+    }
+
+    _ring.cancel(_write);
+    _ring.cancel(_reads[0]);
+    _ring.cancel(_reads[1]);
+}
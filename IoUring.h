@@ -0,0 +1,179 @@
+/*
+Copyright 2009 by Walt Howard
+$Id: IoUring.h 2428 2012-08-14 15:33:13Z whoward $
+*/
+
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+#include <cstddef>
+#include <sys/types.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+/**
+   A thread's io_uring, driven with the raw system calls. Requests from every stream on the thread pile up in one queue and go to
+   the kernel together in a single io_uring_enter, whenever somebody needs a result or calls SubmitQueued(). Data moves through a
+   pool of buffers registered with the kernel once, so it isn't mapped and unmapped on every request.
+
+   ForThread() is NULL when the kernel has no io_uring (too old, or switched off). Callers use the plain system calls then.
+*/
+class IoUring
+{
+public:
+    enum { ENTRIES = 256, BUFFERS = 64, BUFFER_SIZE = 65536 };
+
+    struct Request
+    {
+	enum STATE { IDLE, QUEUED, IN_FLIGHT, DONE };
+
+	STATE _state;
+	uint8_t _opcode; // IORING_OP_READ or IORING_OP_WRITE. The fixed buffer versions are used when the pool is registered.
+	int _fd;
+	int _buffer; // which pool buffer
+	unsigned _length;
+	int _flags; // rw_flags
+	int _result; // when DONE, what the system call would have returned, or -errno
+	bool _poll_first; // wait in the kernel for the descriptor to be ready before trying. Cleared once submitted.
+
+	Request() : _state(IDLE), _opcode(0), _fd(-1), _buffer(-1), _length(0), _flags(0), _result(0), _poll_first(false)
+	{
+	}
+    };
+
+private:
+    int _ring;
+
+    void* _sq_map;
+    size_t _sq_map_size;
+    void* _cq_map;
+    size_t _cq_map_size;
+    io_uring_sqe* _sqes;
+    size_t _sqes_size;
+
+    unsigned* _sq_head;
+    unsigned* _sq_tail;
+    unsigned* _sq_mask;
+    unsigned* _sq_array;
+    unsigned _sq_entries;
+
+    unsigned* _cq_head;
+    unsigned* _cq_tail;
+    unsigned* _cq_mask;
+    io_uring_cqe* _cqes;
+
+    char* _buffers;
+    bool _registered; // the pool is registered with the kernel. If the memlock limit says no, it is used unregistered.
+    std::vector<int> _free;
+
+    std::vector<Request*> _queued; // waiting for the next submit()
+
+    unsigned _unsubmitted; // in the submission ring but not yet passed to the kernel
+
+    bool setup();
+
+    void teardown();
+
+    void enter(const unsigned min_complete);
+
+    void reap();
+
+    // the next free submission entry, cleared. At most one submission entry may be taken and not yet pushed.
+    io_uring_sqe& take();
+
+    // pass the entry from take() on with the next enter()
+    void push();
+
+    IoUring();
+
+    IoUring(const IoUring&);
+
+public:
+    // The calling thread's ring, or NULL if io_uring is not available.
+    static IoUring* ForThread();
+
+    // Submit whatever the calling thread has queued, if it has a ring. Event loops call this once per pass.
+    static void SubmitQueued();
+
+    // A pool buffer, or -1 if they are all in use.
+    int acquire();
+
+    void release(const int buffer);
+
+    char* buffer(const int buffer)
+    {
+	return _buffers + static_cast<size_t>(buffer) * BUFFER_SIZE;
+    }
+
+    // Queue request for the next submit(). It must stay put until it is DONE or cancel()ed.
+    void queue(Request& request);
+
+    // Hand everything queued to the kernel, and collect what has finished, without waiting.
+    void submit();
+
+    // Wait until request is DONE, or timeout_milliseconds (-1 for ever). false if it isn't DONE yet.
+    bool complete(Request& request, const int timeout_milliseconds = -1);
+
+    /** Take a queued request back, or call off one the kernel already has and wait for it to stop. Either way it ends up IDLE with
+	its buffer released. */
+    void cancel(Request& request);
+
+    ~IoUring();
+};
+
+/**
+   One stream's descriptors on its thread's ring, with the same contract as ::read and ::write on a non-blocking descriptor:
+   both return -1 with errno set, EAGAIN when nothing can be done right now.
+
+   write() copies into a pool buffer and returns. Later writes to the same stream join that buffer until it is submitted, so small
+   writes coalesce. What has been written goes out with the next submission on the thread: a read, flush(), a readiness check, an
+   event loop pass. An error from a write that already returned shows up on the next write or flush. A socket or pipe that is full
+   when a write gets to it is polled in the kernel, and the write goes again when there is room.
+
+   Reads of sockets and pipes are done with RWF_NOWAIT, and come back EAGAIN like ::read would. A regular file opened read only is
+   read ahead: the next chunk is already on its way from the disk while the caller works on this one.
+
+   A stream using this must stay on the thread that opened it.
+*/
+class IoUringFile
+{
+    IoUring& _ring;
+
+    const int _read_fd;
+    const int _write_fd;
+
+    bool _regular; // regular file. Reads and writes wait for the disk, as ::read and ::write do.
+    bool _read_ahead;
+
+    IoUring::Request _reads[2]; // the one being handed out and the one after it
+    unsigned _current;
+    size_t _taken; // of the current read
+
+    IoUring::Request _write;
+
+    IoUringFile(IoUring& ring, const int read_fd, const int write_fd);
+
+    void startRead(IoUring::Request& request);
+
+    // deal with a completed write. -1 on error.
+    int settleWrite();
+
+    IoUringFile(const IoUringFile&);
+
+public:
+    // NULL when the thread has no ring
+    static IoUringFile* Attach(const int read_fd, const int write_fd);
+
+    ssize_t read(char* destination, const size_t max_read);
+
+    ssize_t write(const char* source, const size_t amount);
+
+    // Wait until everything written has gone out, for up to timeout_milliseconds (-1 for ever). -1 on error, errno ETIMEDOUT if time ran out.
+    int flush(const int timeout_milliseconds = -1);
+
+    /** Everything outstanding is finished or taken back. A socket or pipe gets no more time to take what was written: flush() first
+	to wait for it. The descriptors are left open. */
+    ~IoUringFile();
+};
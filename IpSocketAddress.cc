@@ -4,6 +4,7 @@ $Id: IpSocketAddress.cc 2428 2012-08-14 15:33:13Z whoward $
 */
 
 #include "IpSocketAddress.h"
+#include <Resolver.h>
 
 IpSocketAddress::IpSocketAddress(const char* address_and_socket)
 {
@@ -20,26 +21,11 @@ IpSocketAddress::IpSocketAddress(const char* address_and_socket)
     rval = sscanf(host, " %3[0-9]%*[.]%3[0-9]%*[.]%3[0-9]%*[.]%3[0-9]", junk, junk, junk, junk);
     if (4 != rval)
     {
-	// this is a dns name, not an ip address
-
-	char auxilliary[1024];
-	struct hostent host_ent;
-	struct hostent* result = &host_ent;
-	int error;
-
-	int rval = gethostbyname_r(host, &host_ent, auxilliary, sizeof(auxilliary), &result, &error);
-
-	if (rval or result == 0)
-	{
-	    if (rval == ERANGE)
-		throw Exception(LOCATION, "gethostbyname_r  failed: %d, probably needs more space than 1024 (see this code)", error);
-
-	    throw Exception(LOCATION, "Could not find address for host \"%s\"", host);
-	}
-
-	IpAddress.sin_addr.s_addr = *reinterpret_cast<unsigned long*>(host_ent.h_addr);
+	// this is a dns name, not an ip address. The resolver's cache usually has it without waiting on DNS.
+	IpAddress.sin_addr = Resolver::Instance().resolve(host);
 	IpAddress.sin_port = htons(port);
 	IpAddress.sin_family = AF_INET;
+	memset(IpAddress.sin_zero, '\0', sizeof(IpAddress.sin_zero));
     }
     else
     {
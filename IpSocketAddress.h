@@ -30,6 +30,11 @@ public:
 	memcpy(&IpAddress, &sock_address, std::min(sizeof(IpAddress), sizeof(sock_address)));
     }
 
+    /**
+       "host:port". A host name is looked up through Resolver::Instance(). That returns at once for a name that is cached, but
+       the first time a name is asked about the constructor waits for the lookup, up to Resolver's default 5 seconds, and throws if
+       it hasn't finished by then. Resolver::prefetch() ahead of time keeps that wait off a connect path.
+    */
     IpSocketAddress(const char* address_and_socket = "0.0.0.0:0");
 
     virtual operator sockaddr_in*()
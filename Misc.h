@@ -11,6 +11,7 @@ $Id: Misc.h 2428 2012-08-14 15:33:13Z whoward $
  */
 
 #include <Text.h>
+#include <NumberFormat.h>
 #include <cerrno>
 #include <string>
 #include <cstring>
@@ -164,6 +165,53 @@ inline Text FromString(const Text& str)
     return str;
 }
 
+/*
+  Numbers skip the streams: no locale, no allocation on the way in, and only the Text on the way out. What is read and written is
+  the same as the stream versions, failures and all: see ParseNumber(). char and its like still go through the streams, which treat
+  them as characters.
+*/
+#define NUMBER_STRINGS(TYPE)								\
+    template<> inline Text ToString<TYPE>(const TYPE& stringme)				\
+    {											\
+	char text[NUMBER_TEXT_SIZE];							\
+	return Text(text, FormatNumber(stringme, text));				\
+    }											\
+    template<> inline void FromString<TYPE>(const Text& str, TYPE& item)		\
+    {											\
+	ParseNumber(str.c_str(), item);							\
+    }											\
+    template<> inline void FromString<TYPE>(const char*& str, TYPE& item)		\
+    {											\
+	ParseNumber(str, item);								\
+    }											\
+    template<> inline TYPE FromString<TYPE>(const Text& str)				\
+    {											\
+	TYPE item;									\
+	ParseNumber(str.c_str(), item);							\
+	return item;									\
+    }											\
+    template<> inline TYPE FromString<TYPE>(const char*& str)				\
+    {											\
+	TYPE item;									\
+	ParseNumber(str, item);								\
+	return item;									\
+    }
+
+NUMBER_STRINGS(bool)
+NUMBER_STRINGS(short)
+NUMBER_STRINGS(unsigned short)
+NUMBER_STRINGS(int)
+NUMBER_STRINGS(unsigned)
+NUMBER_STRINGS(long)
+NUMBER_STRINGS(unsigned long)
+NUMBER_STRINGS(long long)
+NUMBER_STRINGS(unsigned long long)
+NUMBER_STRINGS(float)
+NUMBER_STRINGS(double)
+NUMBER_STRINGS(long double)
+
+#undef NUMBER_STRINGS
+
 /** @brief  The name, just the filename without path, of the currently executing program.
  @note   This extracts the entire commandline of this program from /proc filesystem and returns just the first null delimited string from that.
  */
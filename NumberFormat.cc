@@ -0,0 +1,255 @@
+/*
+Copyright 2009 by Walt Howard
+$Id: NumberFormat.cc 2428 2012-08-14 15:33:13Z whoward $
+*/
+
+#include <NumberFormat.h>
+#include <Misc.h>
+#include <cstdlib>
+#include <alloca.h>
+
+namespace {
+
+inline bool IsSpace(const char c)
+{
+    return c == ' ' or (c >= '\t' and c <= '\r');
+}
+
+inline bool IsDigit(const char c)
+{
+    return static_cast<unsigned char>(c - '0') < 10;
+}
+
+// Exactly representable in a double, so a product or quotient with one is correctly rounded.
+const double Powers[] =
+{
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+const float FloatPowers[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+
+/**
+   What a floating point number in text is made of. _begin to _end is the number, sign and all, with nothing after it for strtod()
+   to take that an istream wouldn't. The digits are also gathered into _mantissa and _exponent, for the numbers simple enough to
+   be converted without strtod().
+*/
+struct Decimal
+{
+    const char* _begin;
+    const char* _end;
+    bool _negative;
+    unsigned long long _mantissa;
+    int _exponent;
+    int _significant; // digits in _mantissa, leading zeros not counted
+    bool _exact; // _mantissa and _exponent are the whole number
+
+    // false if it isn't a number
+    bool scan(const char* text)
+    {
+	while (IsSpace(*text))
+	    ++text;
+
+	_begin = text;
+	_negative = *text == '-';
+
+	if (*text == '-' or *text == '+')
+	    ++text;
+
+	_mantissa = 0;
+	_exponent = 0;
+	_significant = 0;
+	_exact = true;
+
+	bool digits = false;
+
+	for (; IsDigit(*text); ++text, digits = true)
+	    digit(*text, 0);
+
+	if (*text == '.')
+	    for (++text; IsDigit(*text); ++text, digits = true)
+		digit(*text, -1);
+
+	if (not digits)
+	    return false;
+
+	if (*text == 'e' or *text == 'E')
+	{
+	    ++text;
+
+	    const bool negative = *text == '-';
+
+	    if (*text == '-' or *text == '+')
+		++text;
+
+	    if (not IsDigit(*text)) // an istream takes the 'e' and finds nothing after it
+		return false;
+
+	    int exponent = 0;
+
+	    for (; IsDigit(*text); ++text)
+		if (exponent < 100000)
+		    exponent = exponent * 10 + (*text - '0');
+
+	    _exponent += negative ? -exponent : exponent;
+	}
+
+	_end = text;
+	return true;
+    }
+
+    // shift: 0 for a digit before the point, -1 after
+    void digit(const char c, const int shift)
+    {
+	if (_significant >= 19)
+	{
+	    _exact = false;
+	    return;
+	}
+
+	_mantissa = _mantissa * 10 + (c - '0');
+	_exponent += shift;
+
+	if (_mantissa)
+	    ++_significant;
+    }
+};
+
+// strtod() and its like, on just the number
+template<typename REAL> REAL Convert(const Decimal& decimal, REAL (*convert)(const char*, char**))
+{
+    if (not *decimal._end)
+	return convert(decimal._begin, NULL);
+
+    const size_t length = decimal._end - decimal._begin;
+    char* copy = static_cast<char*>(alloca(length + 1));
+    ::memcpy(copy, decimal._begin, length);
+    copy[length] = '\0';
+
+    return convert(copy, NULL);
+}
+
+float Strtof(const char* text, char** end)
+{
+    return ::strtof(text, end);
+}
+
+double Strtod(const char* text, char** end)
+{
+    return ::strtod(text, end);
+}
+
+long double Strtold(const char* text, char** end)
+{
+    return ::strtold(text, end);
+}
+
+// Too big for REAL is the largest there is, and a failure. Too small is zero, or as near as it gets, and is not.
+template<typename REAL> bool Finish(REAL& value, const REAL converted)
+{
+    if (improbable(converted == std::numeric_limits<REAL>::infinity() or converted == -std::numeric_limits<REAL>::infinity()))
+    {
+	value = converted > 0 ? std::numeric_limits<REAL>::max() : -std::numeric_limits<REAL>::max();
+	return false;
+    }
+
+    value = converted;
+    return true;
+}
+
+}
+
+bool ScanInteger(const char* text, bool& negative, unsigned long long& magnitude, bool& overflowed)
+{
+    while (IsSpace(*text))
+	++text;
+
+    negative = *text == '-';
+
+    if (*text == '-' or *text == '+')
+	++text;
+
+    magnitude = 0;
+    overflowed = false;
+
+    if (not IsDigit(*text))
+	return false;
+
+    const unsigned long long most = std::numeric_limits<unsigned long long>::max();
+
+    for (; IsDigit(*text); ++text)
+    {
+	const unsigned digit = *text - '0';
+
+	if (magnitude > (most - digit) / 10)
+	    overflowed = true;
+	else
+	    magnitude = magnitude * 10 + digit;
+    }
+
+    return true;
+}
+
+bool ParseNumber(const char* text, bool& value)
+{
+    long number;
+    const bool parsed = ParseInteger(text, number);
+
+    value = number;
+    return parsed and (number == 0 or number == 1);
+}
+
+bool ParseNumber(const char* text, float& value)
+{
+    Decimal decimal;
+
+    if (not decimal.scan(text))
+    {
+	value = 0;
+	return false;
+    }
+
+    if (decimal._exact and decimal._mantissa <= (1ULL << 24) and decimal._exponent >= -10 and decimal._exponent <= 10)
+    {
+	float converted = static_cast<float>(decimal._mantissa);
+	converted = decimal._exponent < 0 ? converted / FloatPowers[-decimal._exponent] : converted * FloatPowers[decimal._exponent];
+	value = decimal._negative ? -converted : converted;
+	return true;
+    }
+
+    return Finish(value, Convert(decimal, Strtof));
+}
+
+bool ParseNumber(const char* text, double& value)
+{
+    Decimal decimal;
+
+    if (not decimal.scan(text))
+    {
+	value = 0;
+	return false;
+    }
+
+    if (decimal._exact and decimal._mantissa <= (1ULL << 53) and decimal._exponent >= -22 and decimal._exponent <= 22)
+    {
+	double converted = static_cast<double>(decimal._mantissa);
+	converted = decimal._exponent < 0 ? converted / Powers[-decimal._exponent] : converted * Powers[decimal._exponent];
+	value = decimal._negative ? -converted : converted;
+	return true;
+    }
+
+    return Finish(value, Convert(decimal, Strtod));
+}
+
+bool ParseNumber(const char* text, long double& value)
+{
+    Decimal decimal;
+
+    if (not decimal.scan(text))
+    {
+	value = 0;
+	return false;
+    }
+
+    return Finish(value, Convert(decimal, Strtold));
+}
@@ -0,0 +1,205 @@
+/*
+Copyright 2009 by Walt Howard
+$Id: NumberFormat.h 2428 2012-08-14 15:33:13Z whoward $
+*/
+
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+#include <cstddef>
+#include <limits>
+
+/**
+   Numbers to and from text without streams, locales or allocation, for ToString() and FromString(). The text is what a std::ostream
+   with its default formatting would produce: integers in decimal, floating point as printf's %g (six significant digits), bool as 1
+   or 0. It is read the way a std::istream would read it: see ParseNumber().
+*/
+
+enum { NUMBER_TEXT_SIZE = 32 }; // room for anything FormatNumber() writes, and a terminating null
+
+// how many decimal digits value has
+template<typename UNSIGNED> inline size_t CountDigits(UNSIGNED value)
+{
+    size_t digits = 1;
+
+    for (;;)
+    {
+	if (value < 10)
+	    return digits;
+	if (value < 100)
+	    return digits + 1;
+	if (value < 1000)
+	    return digits + 2;
+	if (value < 10000)
+	    return digits + 3;
+
+	value /= 10000;
+	digits += 4;
+    }
+}
+
+// Write the decimal digits of value so they end just before end, two at a time.
+template<typename UNSIGNED> inline void FormatDigits(UNSIGNED value, char* end)
+{
+    static const char pairs[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+    while (value >= 100)
+    {
+	const unsigned pair = static_cast<unsigned>(value % 100) * 2;
+	value /= 100;
+	*--end = pairs[pair + 1];
+	*--end = pairs[pair];
+    }
+
+    if (value >= 10)
+    {
+	*--end = pairs[value * 2 + 1];
+	*--end = pairs[value * 2];
+    }
+    else
+	*--end = '0' + static_cast<char>(value);
+}
+
+/** @brief  Write value into text, which has room for NUMBER_TEXT_SIZE, followed by a null.
+    @return its length
+*/
+inline size_t FormatNumber(const unsigned long long value, char* text)
+{
+    const size_t length = CountDigits(value);
+    FormatDigits(value, text + length);
+    text[length] = '\0';
+    return length;
+}
+
+inline size_t FormatNumber(const long long value, char* text)
+{
+    if (value >= 0)
+	return FormatNumber(static_cast<unsigned long long>(value), text);
+
+    *text = '-';
+    return 1 + FormatNumber(0ULL - static_cast<unsigned long long>(value), text + 1);
+}
+
+inline size_t FormatNumber(const unsigned long value, char* text)
+{
+    return FormatNumber(static_cast<unsigned long long>(value), text);
+}
+
+inline size_t FormatNumber(const long value, char* text)
+{
+    return FormatNumber(static_cast<long long>(value), text);
+}
+
+inline size_t FormatNumber(const unsigned value, char* text)
+{
+    return FormatNumber(static_cast<unsigned long long>(value), text);
+}
+
+inline size_t FormatNumber(const int value, char* text)
+{
+    return FormatNumber(static_cast<long long>(value), text);
+}
+
+inline size_t FormatNumber(const double value, char* text)
+{
+    // Whole numbers %g would print in full go the integer way. Past six digits %g switches to an exponent.
+    if (value > -1e6 and value < 1e6 and value == static_cast<long>(value) and not (value == 0 and std::signbit(value)))
+	return FormatNumber(static_cast<long>(value), text);
+
+    return ::snprintf(text, NUMBER_TEXT_SIZE, "%g", value);
+}
+
+inline size_t FormatNumber(const long double value, char* text)
+{
+    return ::snprintf(text, NUMBER_TEXT_SIZE, "%Lg", value);
+}
+
+/** @brief  Skip white space and a sign, and read the decimal digits after them.
+    @param  overflowed  set if there are more than an unsigned long long holds. magnitude is meaningless then.
+    @return false if there are no digits
+*/
+bool ScanInteger(const char* text, bool& negative, unsigned long long& magnitude, bool& overflowed);
+
+template<typename INTEGER> bool ParseInteger(const char* text, INTEGER& value)
+{
+    typedef std::numeric_limits<INTEGER> Limits;
+
+    bool negative, overflowed;
+    unsigned long long magnitude;
+
+    if (not ScanInteger(text, negative, magnitude, overflowed))
+    {
+	value = 0;
+	return false;
+    }
+
+    // an unsigned type takes a minus sign as an istream does, wrapping round
+    const unsigned long long limit = (Limits::is_signed and negative) ? 0ULL - static_cast<unsigned long long>(Limits::min()) : Limits::max();
+
+    if (overflowed or magnitude > limit)
+    {
+	value = (Limits::is_signed and negative) ? Limits::min() : Limits::max();
+	return false;
+    }
+
+    value = static_cast<INTEGER>(negative ? 0ULL - magnitude : magnitude);
+    return true;
+}
+
+/** @brief  Read a number from text the way a std::istream with default formatting would: leading white space is skipped, then as
+	much as makes a number is read and the rest ignored. Floating point is decimal, with an optional exponent. Not starting with
+	a number leaves value 0, and a number out of range leaves the nearest value there is.
+    @return false in either of those cases, where the istream would have set failbit.
+*/
+inline bool ParseNumber(const char* text, short& value)
+{
+    return ParseInteger(text, value);
+}
+
+inline bool ParseNumber(const char* text, unsigned short& value)
+{
+    return ParseInteger(text, value);
+}
+
+inline bool ParseNumber(const char* text, int& value)
+{
+    return ParseInteger(text, value);
+}
+
+inline bool ParseNumber(const char* text, unsigned& value)
+{
+    return ParseInteger(text, value);
+}
+
+inline bool ParseNumber(const char* text, long& value)
+{
+    return ParseInteger(text, value);
+}
+
+inline bool ParseNumber(const char* text, unsigned long& value)
+{
+    return ParseInteger(text, value);
+}
+
+inline bool ParseNumber(const char* text, long long& value)
+{
+    return ParseInteger(text, value);
+}
+
+inline bool ParseNumber(const char* text, unsigned long long& value)
+{
+    return ParseInteger(text, value);
+}
+
+// 0 or 1. Any other number is true, and a failure.
+bool ParseNumber(const char* text, bool& value);
+
+bool ParseNumber(const char* text, float& value);
+
+bool ParseNumber(const char* text, double& value);
+
+bool ParseNumber(const char* text, long double& value);
@@ -0,0 +1,583 @@
+/*
+Copyright 2009 by Walt Howard
+$Id: Reactor.cc 2428 2012-08-14 15:33:13Z whoward $
+*/
+
+#include <Reactor.h>
+#include <IoUring.h>
+#include <Exception.h>
+#include <Misc.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <algorithm>
+#include <boost/bind.hpp>
+
+namespace {
+
+// how many connections one listener may accept in a pass before the other streams get a turn
+const int AcceptsPerPass = 64;
+
+// the options giving a stream's timeouts, by Reactor::TIMEOUT
+const char* const TimeoutOptions[] = { "READ_TIMEOUT", "WRITE_TIMEOUT", "IDLE_TIMEOUT" };
+
+}
+
+Reactor::Reactor() :
+    _epoll(-1), _wakeup(-1), _last_timer(0), _stopping(false), _dispatching(0), _self(new Reactor*(this))
+{
+    THROW_ON_ERROR(_epoll = ::epoll_create1(EPOLL_CLOEXEC));
+    THROW_ON_ERROR(_wakeup = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    THROW_ON_ERROR(::epoll_ctl(_epoll, EPOLL_CTL_ADD, _wakeup, &event));
+}
+
+void Reactor::watch(Watch& watch, const uint32_t events)
+{
+    if (watch._fd < 0 or events == watch._events)
+	return;
+
+    if (not events)
+    {
+	unwatch(watch);
+	return;
+    }
+
+    struct epoll_event event;
+    event.events = events;
+    event.data.ptr = &watch;
+
+    int rval = ::epoll_ctl(_epoll, watch._events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, watch._fd, &event);
+
+    if (rval == -1 and errno == EEXIST) // left behind by a stream that was closed before being removed, and the number reused
+	rval = ::epoll_ctl(_epoll, EPOLL_CTL_MOD, watch._fd, &event);
+
+    if (rval == -1)
+	throw Exception(LOCATION, "Reactor: can't watch file descriptor %d", watch._fd);
+
+    watch._events = events;
+}
+
+void Reactor::unwatch(Watch& watch)
+{
+    if (not watch._events)
+	return;
+
+    // If the stream was closed before being removed, the kernel has already dropped the descriptor, and the number may belong
+    // to somebody else now.
+    const FileDescriptorStream* stream = watch._owner->_stream;
+    if (watch._fd == stream->get_read_fd() or watch._fd == stream->get_write_fd())
+	::epoll_ctl(_epoll, EPOLL_CTL_DEL, watch._fd, NULL);
+
+    watch._events = 0;
+}
+
+void Reactor::interest(Registration* registration)
+{
+    const Handlers& handlers = registration->_handlers;
+
+    const bool reading = handlers.OnRead or handlers.OnAccept;
+    const bool writing = handlers.OnWrite or registration->_stream->queuedOutput();
+
+    Watch& reader = registration->_reader;
+    Watch& writer = registration->_writer;
+
+    // the reader is always watched, if only for hangups
+    uint32_t read_events = EPOLLRDHUP | (reading ? EPOLLIN : 0);
+
+    if (writer._fd < 0 and writing)
+	read_events |= EPOLLOUT;
+
+    watch(reader, read_events);
+    watch(writer, writing ? EPOLLOUT : 0);
+
+    deadlines(registration);
+}
+
+void Reactor::deadlines(Registration* registration)
+{
+    const Handlers& handlers = registration->_handlers;
+
+    const bool running[] = { not handlers.OnRead.empty(), not handlers.OnWrite.empty() or registration->_stream->queuedOutput(), true };
+
+    for (int which = READ_TIMEOUT; which <= IDLE_TIMEOUT; ++which)
+    {
+	TimerWheel::Timer& timer = registration->_timers[which];
+
+	if (not registration->_timeouts[which] or not running[which])
+	    timer.cancel();
+	else if (not timer.armed())
+	    _wheel.arm(timer, registration->_timeouts[which]);
+    }
+}
+
+void Reactor::progress(Registration* registration)
+{
+    const FileDescriptorStream* stream = registration->_stream;
+
+    const bool read = stream->get_read() != registration->_read;
+    const bool written = stream->get_written() != registration->_written;
+
+    if (not read and not written)
+	return;
+
+    registration->_read = stream->get_read();
+    registration->_written = stream->get_written();
+
+    const bool moved[] = { read, written, true };
+
+    for (int which = READ_TIMEOUT; which <= IDLE_TIMEOUT; ++which)
+	if (moved[which] and registration->_timers[which].armed())
+	    _wheel.arm(registration->_timers[which], registration->_timeouts[which]);
+}
+
+void Reactor::expired(Registration* registration, const TIMEOUT which)
+{
+    FileDescriptorStream* stream = registration->_stream;
+
+    // data can move outside of a dispatch (written from a timer, say) without anybody noticing. That counts.
+    const bool read = stream->get_read() != registration->_read;
+    const bool written = stream->get_written() != registration->_written;
+    const bool moved[] = { read, written, read or written };
+
+    _wheel.arm(registration->_timers[which], registration->_timeouts[which]); // again, while the stream stays quiet
+    progress(registration);
+
+    if (moved[which])
+	return;
+
+    if (registration->_handlers.OnTimeout)
+	registration->_handlers.OnTimeout(stream, which);
+    else
+	hangup(registration);
+}
+
+void Reactor::add(FileDescriptorStream* stream, const Handlers& handlers)
+{
+    if (_registrations.count(stream))
+	throw Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "Reactor: %s is already registered", stream->get_resource().c_str());
+
+    if (stream->get_read_fd() == -2 and stream->get_write_fd() == -2) // opened on first use, like read() and write() do
+	stream->open();
+
+    const int read_fd = stream->get_read_fd();
+    const int write_fd = stream->get_write_fd();
+
+    if (read_fd < 0 and write_fd < 0)
+	throw Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "Reactor: %s is not open", stream->get_resource().c_str());
+
+    Registration* registration = new Registration;
+    registration->_stream = stream;
+    registration->_handlers = handlers;
+    registration->_removed = false;
+    registration->_redispatch = false;
+    registration->_reader._owner = registration;
+    registration->_writer._owner = registration;
+    registration->_reader._fd = GREATER(read_fd, -1);
+    registration->_writer._fd = write_fd != read_fd ? GREATER(write_fd, -1) : -1;
+    registration->_read = stream->get_read();
+    registration->_written = stream->get_written();
+
+    for (int which = READ_TIMEOUT; which <= IDLE_TIMEOUT; ++which)
+    {
+	registration->_timeouts[which] = ::strtoul(stream->get_options().getValue(TimeoutOptions[which]).c_str(), NULL, 0);
+	registration->_timers[which].set_function(boost::bind(&Reactor::expired, this, registration, static_cast<TIMEOUT>(which)));
+    }
+
+    try
+    {
+	interest(registration);
+    }
+    catch (...)
+    {
+	unwatch(registration->_reader);
+	unwatch(registration->_writer);
+	delete registration;
+	throw;
+    }
+
+    _registrations[stream] = registration;
+
+    stream->set_queue_watcher(boost::bind(&Reactor::Queued, boost::weak_ptr<Reactor*>(_self), stream));
+
+    if (stream->buffered() and handlers.OnRead) // epoll won't tell us about what has already been read in
+    {
+	registration->_redispatch = true;
+	_redispatch.push_back(registration);
+    }
+}
+
+void Reactor::update(FileDescriptorStream* stream, const Handlers& handlers)
+{
+    std::unordered_map<FileDescriptorStream*, Registration*>::iterator found = _registrations.find(stream);
+
+    if (found == _registrations.end())
+	throw Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "Reactor: %s is not registered", stream->get_resource().c_str());
+
+    found->second->_handlers = handlers;
+    interest(found->second);
+}
+
+void Reactor::remove(FileDescriptorStream* stream)
+{
+    std::unordered_map<FileDescriptorStream*, Registration*>::iterator found = _registrations.find(stream);
+
+    if (found == _registrations.end())
+	return;
+
+    Registration* registration = found->second;
+    _registrations.erase(found);
+
+    registration->_removed = true;
+    stream->set_queue_watcher(Stream::OutputHandler());
+
+    for (int which = READ_TIMEOUT; which <= IDLE_TIMEOUT; ++which)
+	registration->_timers[which].cancel();
+
+    unwatch(registration->_reader);
+    unwatch(registration->_writer);
+
+    if (registration->_redispatch)
+	_redispatch.erase(std::find(_redispatch.begin(), _redispatch.end(), registration));
+
+    // events still to be dispatched in this pass may point at it
+    _graveyard.push_back(registration);
+
+    if (not _dispatching)
+	bury();
+}
+
+void Reactor::bury()
+{
+    for (std::vector<Registration*>::iterator i(_graveyard.begin()); i != _graveyard.end(); ++i)
+	delete *i;
+
+    _graveyard.clear();
+}
+
+size_t Reactor::readable(Registration* registration)
+{
+    FileDescriptorStream* stream = registration->_stream;
+
+    const size_t buffered = stream->buffered();
+    const unsigned long long read = stream->get_read();
+
+    registration->_handlers.OnRead(stream);
+
+    if (registration->_removed)
+	return 1;
+
+    if (stream->eof())
+    {
+	hangup(registration);
+	return 1;
+    }
+
+    // Anything left in the buffer has to be offered again, since epoll only knows about the descriptor. But not if the handler
+    // took nothing and read nothing: it is waiting for more to arrive and would just be called over and over.
+    if (stream->buffered() and not registration->_redispatch and (stream->buffered() != buffered or stream->get_read() != read))
+    {
+	registration->_redispatch = true;
+	_redispatch.push_back(registration);
+    }
+
+    return 1;
+}
+
+size_t Reactor::accepting(Registration* registration)
+{
+    size_t accepted = 0;
+
+    while (accepted < AcceptsPerPass and not registration->_removed)
+    {
+	Stream* stream = registration->_stream->accept();
+
+	if (not stream) // no more waiting
+	    break;
+
+	FileDescriptorStream* connection = dynamic_cast<FileDescriptorStream*>(stream);
+
+	if (not connection)
+	{
+	    delete stream;
+	    throw Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "Reactor: %s accepted something that is not a FileDescriptorStream",
+			    registration->_stream->get_resource().c_str());
+	}
+
+	++accepted;
+	registration->_handlers.OnAccept(connection);
+    }
+
+    return accepted;
+}
+
+size_t Reactor::hangup(Registration* registration)
+{
+    FileDescriptorStream* stream = registration->_stream;
+
+    // removed first, so the handler is free to delete the stream. The registration itself lasts until the end of the pass.
+    remove(stream);
+
+    if (registration->_handlers.OnHangup)
+    {
+	registration->_handlers.OnHangup(stream);
+	return 1;
+    }
+
+    return 0;
+}
+
+size_t Reactor::draining(Registration* registration)
+{
+    try
+    {
+	registration->_stream->flush();
+    }
+    catch (const std::exception& ex)
+    {
+	return hangup(registration);
+    }
+
+    if (not registration->_removed) // by a watermark handler
+	interest(registration);
+
+    return 0;
+}
+
+void Reactor::Queued(const boost::weak_ptr<Reactor*>& reactor, FileDescriptorStream* stream)
+{
+    if (boost::shared_ptr<Reactor*> alive = reactor.lock())
+	(*alive)->queued(stream);
+}
+
+void Reactor::queued(FileDescriptorStream* stream)
+{
+    std::unordered_map<FileDescriptorStream*, Registration*>::iterator found = _registrations.find(stream);
+
+    if (found != _registrations.end())
+	interest(found->second);
+}
+
+Reactor::TimerId Reactor::after(const unsigned milliseconds, const Function& function)
+{
+    const TimerId id = ++_last_timer;
+
+    Timer& timer = _timers[id];
+    timer._function = function;
+    timer._due = TimerWheel::Now() + milliseconds;
+    timer._timer.set_function(boost::bind(&Reactor::fire, this, id));
+
+    _wheel.arm(timer._timer, milliseconds);
+
+    return id;
+}
+
+Reactor::TimerId Reactor::every(const unsigned milliseconds, const Function& function)
+{
+    const TimerId id = after(milliseconds, function);
+
+    _timers[id]._interval_milliseconds = GREATER(milliseconds, 1u);
+
+    return id;
+}
+
+bool Reactor::cancel(const TimerId timer)
+{
+    // the wheel lets go of it as it is destroyed
+    return _timers.erase(timer);
+}
+
+void Reactor::fire(const TimerId id)
+{
+    std::unordered_map<TimerId, Timer>::iterator found = _timers.find(id);
+
+    if (found == _timers.end())
+	return;
+
+    Timer& timer = found->second;
+    const Function function(timer._function);
+
+    // rescheduled before it is called, so it can cancel itself
+    if (timer._interval_milliseconds)
+    {
+	const uint64_t now = TimerWheel::Now();
+
+	timer._due += timer._interval_milliseconds;
+
+	if (timer._due <= now) // fell behind. Don't try to catch up.
+	    timer._due = now + timer._interval_milliseconds;
+
+	_wheel.arm(timer._timer, timer._due - now);
+    }
+    else
+	_timers.erase(found);
+
+    function();
+}
+
+void Reactor::post(const Function& function)
+{
+    bool was_empty;
+
+    {
+	boost::mutex::scoped_lock lock(_posted_lock);
+	was_empty = _posted.empty();
+	_posted.push_back(function);
+    }
+
+    // if there was something there already, whoever put it there has woken the loop and it hasn't taken the list yet
+    if (was_empty)
+	wakeup();
+}
+
+void Reactor::wakeup()
+{
+    const uint64_t one = 1;
+    if (::write(_wakeup, &one, sizeof(one)) == -1 and errno != EAGAIN) // EAGAIN means it is already as awake as it gets
+	throw Exception(LOCATION, "Reactor: can't write wakeup eventfd");
+}
+
+size_t Reactor::runPosted()
+{
+    uint64_t count;
+    if (::read(_wakeup, &count, sizeof(count)) == -1 and errno != EAGAIN)
+	throw Exception(LOCATION, "Reactor: can't read wakeup eventfd");
+
+    std::vector<Function> posted;
+
+    {
+	boost::mutex::scoped_lock lock(_posted_lock);
+	posted.swap(_posted);
+    }
+
+    for (std::vector<Function>::iterator function(posted.begin()); function != posted.end(); ++function)
+	(*function)();
+
+    return posted.size();
+}
+
+size_t Reactor::runOnce(const int timeout_milliseconds)
+{
+    // removed registrations are only deleted once nothing in this pass can refer to them, whether it ends normally or by a throw
+    struct Dispatching
+    {
+	Reactor& _reactor;
+
+	Dispatching(Reactor& reactor) : _reactor(reactor)
+	{
+	    ++_reactor._dispatching;
+	}
+
+	~Dispatching()
+	{
+	    if (not --_reactor._dispatching)
+		_reactor.bury();
+	}
+    } dispatching(*this);
+
+    // streams that still had data buffered after the last pass
+    std::vector<Registration*> again;
+    again.swap(_redispatch);
+
+    for (std::vector<Registration*>::iterator r(again.begin()); r != again.end(); ++r)
+	(*r)->_redispatch = false;
+
+    // writes queued for io_uring by any stream (URING option) go to the kernel together, before we sleep
+    IoUring::SubmitQueued();
+
+    struct epoll_event events[256];
+
+    int ready = ::epoll_wait(_epoll, events, sizeof(events) / sizeof(events[0]), again.empty() ? _wheel.nextTimeout(timeout_milliseconds) : 0);
+
+    if (ready == -1)
+    {
+	if (errno != EINTR)
+	    throw Exception(LOCATION, "Reactor: epoll_wait");
+	ready = 0;
+    }
+
+    size_t dispatched = 0;
+
+    for (int e = 0; e < ready; ++e)
+    {
+	Watch* watch = static_cast<Watch*>(events[e].data.ptr);
+
+	if (not watch)
+	{
+	    dispatched += runPosted();
+	    continue;
+	}
+
+	Registration* registration = watch->_owner;
+	const uint32_t happened = events[e].events;
+	bool handled = false;
+
+	if (registration->_removed) // by a handler earlier in this pass
+	    continue;
+
+	if ((happened & EPOLLOUT) and registration->_stream->queuedOutput())
+	    dispatched += draining(registration);
+
+	if ((happened & EPOLLOUT) and registration->_handlers.OnWrite and not registration->_removed and not registration->_stream->queuedOutput())
+	{
+	    registration->_handlers.OnWrite(registration->_stream);
+	    ++dispatched;
+	    handled = true;
+	}
+
+	if ((happened & EPOLLIN) and watch == &registration->_reader and not registration->_removed)
+	{
+	    if (registration->_handlers.OnAccept)
+		dispatched += accepting(registration);
+	    else if (registration->_handlers.OnRead)
+		dispatched += readable(registration);
+	    handled = true;
+	}
+
+	// Hangups that come with data are found by the reader reaching eof, once it has had the data.
+	if ((happened & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) and not handled and not registration->_removed)
+	    dispatched += hangup(registration);
+
+	if (not registration->_removed)
+	    progress(registration);
+    }
+
+    for (std::vector<Registration*>::iterator r(again.begin()); r != again.end(); ++r)
+	if (not (*r)->_removed and (*r)->_stream->buffered())
+	{
+	    dispatched += readable(*r);
+
+	    if (not (*r)->_removed)
+		progress(*r);
+	}
+
+    dispatched += _wheel.advance(); // stream timeouts and timers alike
+
+    return dispatched;
+}
+
+void Reactor::run()
+{
+    while (not _stopping.exchange(false))
+	runOnce();
+}
+
+void Reactor::stop()
+{
+    _stopping = true;
+    wakeup();
+}
+
+Reactor::~Reactor()
+{
+    for (std::unordered_map<FileDescriptorStream*, Registration*>::iterator i(_registrations.begin()); i != _registrations.end(); ++i)
+	delete i->second;
+
+    bury();
+
+    ::close(_wakeup);
+    ::close(_epoll);
+}
@@ -0,0 +1,225 @@
+/*
+Copyright 2009 by Walt Howard
+$Id: Reactor.h 2428 2012-08-14 15:33:13Z whoward $
+*/
+
+#pragma once
+
+#include <FileDescriptorStream.h>
+#include <TimerWheel.h>
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+/**
+   An epoll event loop for FileDescriptorStreams, so one thread can serve any number of them without building descriptor lists and
+   polling each time around. Register a stream with the handlers it needs and call run() (or runOnce() from your own loop).
+
+   Streams with separate read and write descriptors (ExecStream) are watched on both. A listening stream (TcpServiceStream) given an
+   OnAccept handler has its connections accepted for it, and each new stream is handed to OnAccept, which owns it from then on. Data
+   a handler leaves in a stream's read buffer is dispatched to OnRead again on the next pass even though epoll has nothing more to
+   say about the descriptor, so handlers can take one message at a time.
+
+   The reactor never owns or closes the streams registered with it. Remove a stream before closing or deleting it. A handler may add
+   or remove any stream, including its own, and when a stream hangs up it is removed before OnHangup is called so the handler can
+   delete it.
+
+   Streams with an output queue (QUEUE option) have it sent for them: whenever output queues up on one, the reactor watches for it
+   to become writable and sends what it can, before OnWrite, which is only called once the queue is empty. A stream whose queue
+   fails to send is hung up.
+
+   A stream's options can give it timeouts, in milliseconds, which the reactor keeps on a TimerWheel:
+
+   - READ_TIMEOUT  nothing has arrived for that long while there is an OnRead handler.
+   - WRITE_TIMEOUT output has been waiting to go, in the output queue or for OnWrite, and none has gone for that long.
+   - IDLE_TIMEOUT  nothing has gone either way for that long.
+
+   A timeout goes to OnTimeout, or if there is none the stream is hung up. It goes again every so many milliseconds for as long as
+   the stream stays quiet, and starts over whenever data moves. Nothing throws and no wait is cut short, and starting one over is
+   constant time, so timing out every connection costs next to nothing until they run out.
+
+   Only post(), wakeup() and stop() may be called from other threads. Everything else belongs to the thread running the loop.
+*/
+class Reactor
+{
+public:
+    typedef boost::function<void (FileDescriptorStream* stream)> Handler;
+
+    typedef boost::function<void ()> Function;
+
+    enum TIMEOUT { READ_TIMEOUT, WRITE_TIMEOUT, IDLE_TIMEOUT };
+
+    typedef boost::function<void (FileDescriptorStream* stream, TIMEOUT which)> TimeoutHandler;
+
+    typedef uint64_t TimerId;
+
+    struct Handlers
+    {
+	Handler OnRead; // data has arrived, or is still sitting in the stream's buffer
+	Handler OnWrite; // the stream can take more. Leave it empty unless there is something waiting to go or it will fire constantly.
+	Handler OnAccept; // called with each newly accepted stream instead of OnRead being called on the listener
+	Handler OnHangup; // the other end went away or the descriptor failed. Without this the stream is just removed.
+	TimeoutHandler OnTimeout; // one of the stream's timeouts ran out. Without this the stream is hung up.
+    };
+
+private:
+    struct Registration;
+
+    // one registered descriptor. epoll hands these back to us.
+    struct Watch
+    {
+	Registration* _owner;
+	int _fd;
+	uint32_t _events; // what epoll is currently watching for on _fd
+
+	Watch() : _owner(NULL), _fd(-1), _events(0)
+	{
+	}
+    };
+
+    struct Registration
+    {
+	FileDescriptorStream* _stream;
+	Handlers _handlers;
+	Watch _reader; // when the stream reads and writes through one descriptor this watches both ways
+	Watch _writer;
+	bool _removed;
+	bool _redispatch; // already queued to have its buffered data dispatched
+
+	unsigned _timeouts[3]; // milliseconds from the stream's options, by TIMEOUT. 0 for none.
+	TimerWheel::Timer _timers[3];
+	unsigned long long _read; // the stream's counts when they were last seen to move
+	unsigned long long _written;
+    };
+
+    // an after() or every() timer
+    struct Timer
+    {
+	TimerWheel::Timer _timer;
+	Function _function;
+	unsigned _interval_milliseconds; // 0 for one shot
+	uint64_t _due; // when it was last due, so every() doesn't drift
+
+	Timer() : _interval_milliseconds(0), _due(0)
+	{
+	}
+    };
+
+    int _epoll;
+
+    int _wakeup; // eventfd. Its Watch is NULL.
+
+    std::unordered_map<FileDescriptorStream*, Registration*> _registrations;
+
+    std::vector<Registration*> _redispatch; // left data in their buffers last time
+    std::vector<Registration*> _graveyard; // removed, deleted when no event can be pointing at them any more
+
+    TimerWheel _wheel; // stream timeouts, and the timers below
+
+    std::unordered_map<TimerId, Timer> _timers;
+    TimerId _last_timer;
+
+    boost::mutex _posted_lock;
+    std::vector<Function> _posted;
+
+    std::atomic<bool> _stopping;
+
+    size_t _dispatching; // nesting depth of runOnce()
+
+    boost::shared_ptr<Reactor*> _self; // for Queued()
+
+    void watch(Watch& watch, const uint32_t events);
+
+    void unwatch(Watch& watch);
+
+    void interest(Registration* registration);
+
+    // each returns how many handlers it called
+    size_t readable(Registration* registration);
+
+    size_t accepting(Registration* registration);
+
+    size_t hangup(Registration* registration);
+
+    size_t draining(Registration* registration);
+
+    // the stream's output queue has something in it
+    void queued(FileDescriptorStream* stream);
+
+    // The stream's queue watcher goes through this, since the stream may outlive the reactor.
+    static void Queued(const boost::weak_ptr<Reactor*>& reactor, FileDescriptorStream* stream);
+
+    // set which timeouts should be running according to the handlers and what is waiting to be written
+    void deadlines(Registration* registration);
+
+    // restart the timeouts if data has moved since they were last started
+    void progress(Registration* registration);
+
+    void expired(Registration* registration, const TIMEOUT which);
+
+    void bury();
+
+    size_t runPosted();
+
+    // an after() or every() timer is due
+    void fire(const TimerId id);
+
+    Reactor(const Reactor&);
+    Reactor& operator=(const Reactor&);
+
+public:
+    Reactor();
+
+    // Start dispatching events on stream to handlers. A stream can only be registered once.
+    void add(FileDescriptorStream* stream, const Handlers& handlers);
+
+    // Replace a registered stream's handlers. Which events are watched follows from which handlers are set.
+    void update(FileDescriptorStream* stream, const Handlers& handlers);
+
+    // Stop dispatching events on stream. Does nothing if it isn't registered.
+    void remove(FileDescriptorStream* stream);
+
+    bool contains(FileDescriptorStream* stream) const
+    {
+	return _registrations.count(stream);
+    }
+
+    size_t size() const
+    {
+	return _registrations.size();
+    }
+
+    // Call function once, milliseconds from now. Timers go on the same TimerWheel as the stream timeouts: setting and cancelling
+    // one is constant time, and it fires on the first pass at or after it is due.
+    TimerId after(const unsigned milliseconds, const Function& function);
+
+    // Call function every milliseconds until cancelled.
+    TimerId every(const unsigned milliseconds, const Function& function);
+
+    // @return false if the timer had already fired (one shot) or been cancelled.
+    bool cancel(const TimerId timer);
+
+    // Have the loop thread call function. Safe from any thread.
+    void post(const Function& function);
+
+    // Interrupt a wait in progress. Safe from any thread.
+    void wakeup();
+
+    /** @brief  Wait up to timeout_milliseconds (-1 forever) for something to happen and dispatch everything that did.
+	@return the number of handlers, timers and posted functions called.
+    */
+    size_t runOnce(const int timeout_milliseconds = -1);
+
+    // runOnce() until stop() is called.
+    void run();
+
+    // Safe from any thread.
+    void stop();
+
+    ~Reactor();
+};
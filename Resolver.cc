@@ -0,0 +1,232 @@
+/*
+Copyright 2009 by Walt Howard
+$Id: Resolver.cc 2428 2012-08-14 15:33:13Z whoward $
+*/
+
+#include <Resolver.h>
+#include <Exception.h>
+#include <boost/thread/thread.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/bind.hpp>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <time.h>
+
+Resolver::Resolver() : _ttl(60000), _negative_ttl(5000), _threads(0), _idle(0), _pruned(0)
+{
+}
+
+uint64_t Resolver::Now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+void Resolver::request(const Text& host, Entry& entry)
+{
+    if (entry._queued)
+	return;
+
+    entry._queued = true;
+    _queue.push_back(host);
+
+    // a lookup takes as long as DNS likes, so nothing waits behind one while there's a thread to spare
+    if (_idle < _queue.size() and _threads < LOOKUP_THREADS)
+    {
+	// the threads live as long as the process, like the cache
+	boost::thread(boost::bind(&Resolver::run, this)).detach();
+	++_threads;
+    }
+
+    _queue_changed.notify_one();
+}
+
+void Resolver::run()
+{
+    for (;;)
+    {
+	Text host;
+
+	{
+	    boost::mutex::scoped_lock lock(_lock);
+
+	    ++_idle;
+	    while (_queue.empty())
+		_queue_changed.wait(lock);
+	    --_idle;
+
+	    host = _queue.front();
+	    _queue.pop_front();
+	}
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM; // otherwise each address comes back once per socket type
+
+	struct addrinfo* result = NULL;
+	int error = getaddrinfo(host.c_str(), NULL, &hints, &result);
+
+	std::vector<in_addr> addresses;
+
+	for (struct addrinfo* info = result; info; info = info->ai_next)
+	{
+	    in_addr address = reinterpret_cast<sockaddr_in*>(info->ai_addr)->sin_addr;
+
+	    bool seen = false;
+	    for (size_t i = 0; i < addresses.size() and not seen; ++i)
+		seen = addresses[i].s_addr == address.s_addr;
+
+	    if (not seen)
+		addresses.push_back(address);
+	}
+
+	if (result)
+	    freeaddrinfo(result);
+
+	boost::mutex::scoped_lock lock(_lock);
+
+	Entry& entry = _cache[host];
+	const uint64_t now = Now();
+
+	entry._queued = false;
+
+	if (not addresses.empty())
+	{
+	    entry._addresses = addresses;
+	    entry._expires = now + _ttl;
+	    entry._refresh = now + _ttl / 5 * 4;
+	}
+	else if (error == EAI_NONAME or error == EAI_NODATA or not entry._resolved or entry._addresses.empty())
+	{
+	    entry._addresses.clear();
+	    entry._expires = entry._refresh = now + _negative_ttl;
+	}
+	else
+	{
+	    // DNS is having trouble. What we had is better than nothing.
+	    entry._expires = entry._refresh = now + _negative_ttl;
+	}
+
+	entry._resolved = true;
+
+	_resolved.notify_all();
+
+	if (now - _pruned >= GREATER(_negative_ttl, 1000u))
+	{
+	    prune(now);
+	    _pruned = now;
+	}
+    }
+}
+
+void Resolver::prune(const uint64_t now)
+{
+    for (std::map<Text, Entry>::iterator entry = _cache.begin(); entry != _cache.end();)
+    {
+	const Entry& name = entry->second;
+
+	// what we had for a name that still exists is handed out while it is refreshed, so it stays a while longer
+	const uint64_t stale = name._addresses.empty() ? name._expires : name._expires + _ttl;
+
+	if (now > stale and not name._queued and not name._waiting)
+	    _cache.erase(entry++);
+	else
+	    ++entry;
+    }
+}
+
+Resolver::Entry& Resolver::find(boost::mutex::scoped_lock& lock, const char* host, const unsigned timeout_milliseconds)
+{
+    const Text name(host);
+
+    Entry& entry = _cache[name];
+
+    const uint64_t now = Now();
+
+    if (probable(entry._resolved))
+    {
+	if (now >= entry._refresh)
+	{
+	    request(name, entry);
+
+	    // a name that didn't exist has to be asked about again before anybody is told it still doesn't
+	    if (now >= entry._expires and entry._addresses.empty())
+		entry._resolved = false;
+	}
+
+	if (entry._resolved)
+	    return entry;
+    }
+
+    request(name, entry);
+
+    // by the monotonic clock, so setting the time of day neither cuts the wait short nor stretches it
+    const uint64_t deadline = Now() + timeout_milliseconds;
+
+    ++entry._waiting; // keeps prune() off it
+
+    while (not entry._resolved)
+    {
+	const uint64_t now = Now();
+
+	if (now >= deadline)
+	{
+	    --entry._waiting;
+	    throw Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "Timed out after %u milliseconds looking up \"%s\"", timeout_milliseconds, host);
+	}
+
+	_resolved.timed_wait(lock, boost::posix_time::milliseconds(deadline - now));
+    }
+
+    --entry._waiting;
+    return entry;
+}
+
+std::vector<in_addr> Resolver::lookup(const char* host, const unsigned timeout_milliseconds)
+{
+    boost::mutex::scoped_lock lock(_lock);
+    return find(lock, host, timeout_milliseconds)._addresses;
+}
+
+in_addr Resolver::resolve(const char* host, const unsigned timeout_milliseconds)
+{
+    boost::mutex::scoped_lock lock(_lock);
+
+    Entry& entry = find(lock, host, timeout_milliseconds);
+
+    if (entry._addresses.empty())
+	throw Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "Could not find address for host \"%s\"", host);
+
+    return entry._addresses[entry._next++ % entry._addresses.size()];
+}
+
+void Resolver::prefetch(const char* host)
+{
+    boost::mutex::scoped_lock lock(_lock);
+
+    const Text name(host);
+    Entry& entry = _cache[name];
+
+    if (not entry._resolved or Now() >= entry._refresh)
+	request(name, entry);
+}
+
+void Resolver::clear()
+{
+    boost::mutex::scoped_lock lock(_lock);
+
+    // entries being looked up stay, so the helper thread's answer has somewhere to go
+    for (std::map<Text, Entry>::iterator entry = _cache.begin(); entry != _cache.end();)
+    {
+	if (entry->second._queued)
+	{
+	    entry->second._resolved = false;
+	    ++entry;
+	}
+	else
+	    _cache.erase(entry++);
+    }
+}
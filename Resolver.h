@@ -0,0 +1,112 @@
+/*
+Copyright 2009 by Walt Howard
+$Id: Resolver.h 2428 2012-08-14 15:33:13Z whoward $
+*/
+
+#pragma once
+
+#include <Text.h>
+#include <Misc.h>
+#include <Singleton.h>
+#include <netinet/in.h>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <map>
+#include <deque>
+#include <vector>
+#include <stdint.h>
+
+/**
+   The process's host name cache. Names are looked up with getaddrinfo on helper threads, IPv4 only, so callers wait on DNS only
+   for a name they have never asked about (up to the timeout they give) and never for one that is cached. Up to LOOKUP_THREADS
+   names are looked up at once, so one that is slow to answer doesn't hold up the others.
+
+   - A name is kept for ttl milliseconds. Past 80% of that the next lookup queues a refresh and carries on with what is cached.
+   - Past ttl the cached addresses are still returned while the refresh runs, so a slow or dead DNS server holds nobody up. A
+     failed refresh keeps them for another negative_ttl.
+   - A name that doesn't exist is remembered as such for negative_ttl.
+   - A name with several addresses hands them out in turn from resolve(), spreading connections over them.
+   - Names nobody asks about go: one that doesn't exist once its negative_ttl is up, the rest a ttl after they expire.
+
+   getaddrinfo doesn't say what TTL the DNS record had, so the times are set here rather than taken from the records. Lookups go
+   through nsswitch as usual, /etc/hosts included; bench/ResolverBench checks the cache against it with no network.
+
+   Resolver::Instance() is the one IpSocketAddress uses.
+*/
+class Resolver
+{
+    struct Entry
+    {
+	std::vector<in_addr> _addresses; // empty when the name doesn't exist
+	uint64_t _expires;
+	uint64_t _refresh; // queue a refresh when asked about after this
+	size_t _next; // round robin
+	bool _resolved; // has been looked up at least once
+	bool _queued; // waiting for or in a lookup
+	unsigned _waiting; // callers in find() waiting for it
+
+	Entry() : _expires(0), _refresh(0), _next(0), _resolved(false), _queued(false), _waiting(0)
+	{
+	}
+    };
+
+    unsigned _ttl;
+    unsigned _negative_ttl;
+
+    boost::mutex _lock;
+    boost::condition_variable _queue_changed;
+    boost::condition_variable _resolved;
+
+    std::map<Text, Entry> _cache;
+    std::deque<Text> _queue;
+    unsigned _threads; // helper threads started
+    unsigned _idle; // helper threads waiting for something to look up
+    uint64_t _pruned; // when names nobody asks about were last dropped
+
+    static uint64_t Now();
+
+    // Queue host for a helper thread, starting another if they are all busy. Called with the lock held.
+    void request(const Text& host, Entry& entry);
+
+    // A helper thread
+    void run();
+
+    // Drop the names nobody asks about. Called with the lock held.
+    void prune(const uint64_t now);
+
+    // Wait until host is resolved, up to timeout_milliseconds. Called with the lock held.
+    Entry& find(boost::mutex::scoped_lock& lock, const char* host, const unsigned timeout_milliseconds);
+
+    Resolver(const Resolver&);
+    Resolver& operator=(const Resolver&);
+
+public:
+    enum { LOOKUP_THREADS = 8 };
+
+    Resolver();
+
+    static Resolver& Instance()
+    {
+	return *Singleton<Resolver>::instance();
+    }
+
+    GETSET(unsigned, _ttl);
+    GETSET(unsigned, _negative_ttl);
+
+    /** @brief  host's addresses, waiting up to timeout_milliseconds if it isn't cached yet.
+	@return empty if the name doesn't exist.
+	@throw  if the lookup didn't finish in time. It carries on in the background and later calls will have the answer.
+    */
+    std::vector<in_addr> lookup(const char* host, const unsigned timeout_milliseconds = 5000);
+
+    /** @brief  The next of host's addresses in rotation.
+	@throw  if the name doesn't exist, or the lookup didn't finish in time.
+    */
+    in_addr resolve(const char* host, const unsigned timeout_milliseconds = 5000);
+
+    // Start looking host up if it isn't cached, without waiting. Warms the cache ahead of the first connect.
+    void prefetch(const char* host);
+
+    // Drop everything cached, so the next lookup of every name goes to the system.
+    void clear();
+};
@@ -5,6 +5,7 @@
 
 
 #include <Serialize.h>
+#include <Stream.h>
 #include <Text.h>
 #include <cstdlib>
 
@@ -81,6 +82,21 @@ Text SerializeClassName(Channel& channel, const char* class_name = NULL)
     }
 }
 
+void ReadSerialized(Channel& channel, Stream& stream, void* destination, const size_t bytes)
+{
+    const size_t got = stream.readAllWithTimeout(bytes, static_cast<char*>(destination), channel.get_timeout_milliseconds());
+
+    if (probable(got == bytes))
+	return;
+
+    if (stream.eof())
+	ThrowSerializationException(channel, StringPrintf(0, "%s ended with %zu bytes of an item still to come", stream.get_resource().c_str(),
+							  bytes - got));
+
+    ThrowSerializationException(channel, StringPrintf(0, "Timed out after %d ms waiting for %zu more bytes from %s", channel.get_timeout_milliseconds(),
+						      bytes - got, stream.get_resource().c_str()));
+}
+
 /** @brief  Throws exception giving a lot of information related to serializing.
  *   @param  file       The libiViaCore File object being streamed to/from.
  *   @param  direction  Direction of information flow, IN = deserializing, OUT = serializing.
@@ -88,6 +104,7 @@ Text SerializeClassName(Channel& channel, const char* class_name = NULL)
  */
 void ThrowSerializationException(const Channel& channel, const Text& message, int errnum)
 {
-    Text msg = StringPrintf(0, "%s (while %s at offset %ld)", message.c_str(), Channel::IN ? "serializing in" : "serializing out", channel.get_offset());
-    throw Exception(LOCATION, msg.c_str(), errnum);
+    Text msg = StringPrintf(0, "%s (while %s at offset %ld)", message.c_str(), channel.get_direction() == Channel::IN ? "serializing in" : "serializing out",
+			    channel.get_offset());
+    throw Exception(errnum, LOCATION, msg);
 }
@@ -9,12 +9,14 @@
 #include <Channel.h>
 #include <cstring>
 #include <string>
+#include <array>
 #include <deque>
 #include <list>
 #include <map>
 #include <set>
 #include <vector>
 #include <unordered_map>
+#include <type_traits>
 #include <Misc.h>
 #include <errno.h>
 #include <iostream>
@@ -159,6 +161,13 @@
  */
 void ThrowSerializationException(const Channel& channel, const Text& message, int errnum = Exception::ERRNO_IGNORE);
 
+class Stream;
+
+/** @brief  For channels over a Stream: read exactly bytes, waiting as long as channel.get_timeout_milliseconds() for them to arrive.
+ *   @throw  Exception if they don't, or the stream ends first.
+ */
+void ReadSerialized(Channel& channel, Stream& stream, void* destination, const size_t bytes);
+
 /**
    Used at the beginning of serialization to either write out, or read in a name and version for the class being serialized. You don't have to use the
    actual name of the class as "name" but make sure whoever is deserializing knows what to deserialize when it sees the name. If
@@ -216,7 +225,7 @@ public:
         // we terminate the channel and mark it as closed so it cannot be reused by accident. This forces the caller to call open() again (which should tell him the name of the next class which
         // is in the stream so he can deserialize properly)
 	channel.set_open(channel.get_open() - 1);
-	if (channel.get_open() == 0)
+	if (channel.get_open() == 1) // back to what open() left: this was the outermost object
 	{
             channel.set_open(0);
             channel.close();
@@ -482,11 +491,103 @@ template<typename StlContainer> void SerializeContainer(Channel& channel, StlCon
     channel.endOfClass(ClassName(cont).c_str(), label);
 }
 
-template<typename Element> inline void Serialize(Channel& channel, std::vector<Element>& container, const char* label)
+/**
+   Element types whose arrays (std::vector, std::array and C arrays) a blockable() channel moves as one block of bytes. Numbers are. bool is
+   not, since anything but 0 or 1 read back into one is undefined, and std::vector<bool> has no array to copy. Specialize this to
+   std::true_type for your own trivially copyable structs, as long as their serialize() writes every member as it is and nothing else.
+*/
+// the most a vector read IN as a block grows by before what it has been given has arrived
+enum { SERIALIZE_BLOCK_CHUNK = 1 << 20 };
+
+template<typename ELEMENT> struct SerializeAsBlock : std::integral_constant<bool, std::is_arithmetic<ELEMENT>::value and not std::is_same<ELEMENT, bool>::value>
+{
+};
+
+template<typename ELEMENT> inline bool SerializesAsBlock(const Channel& channel)
+{
+    static_assert(not SerializeAsBlock<ELEMENT>::value or std::is_trivially_copyable<ELEMENT>::value, "SerializeAsBlock of a type that can't be memcpy'd");
+    return SerializeAsBlock<ELEMENT>::value and channel.blockable();
+}
+
+// An array whose size is fixed: the count is written as for any container, and has to match when reading back in.
+template<typename ELEMENT> void SerializeFixedArray(Channel& channel, ELEMENT* elements, const size_t count, const char* classname, const char* label)
+{
+    channel.startOfClass(classname, label);
+
+    uint64_t element_count = count;
+    Serialize(channel, element_count, "count");
+
+    if (element_count != count)
+	ThrowSerializationException(channel, StringPrintf(0, "%s of %zu serialized in with %llu elements", classname, count,
+							  static_cast<unsigned long long>(element_count)));
+
+    if (SerializesAsBlock<ELEMENT>(channel))
+	channel.serializeBlock(elements, count * sizeof(ELEMENT), label);
+    else
+	for (size_t i = 0; i < count; ++i)
+	    Serialize(channel, elements[i], "member");
+
+    channel.endOfClass(classname, label);
+}
+
+template<typename Element> inline void SerializeVector(Channel& channel, std::vector<Element>& container, const char* label, std::false_type)
 {
     SerializeContainer(channel, container, label);
 }
 
+template<typename Element> inline void SerializeVector(Channel& channel, std::vector<Element>& container, const char* label, std::true_type)
+{
+    if (not SerializesAsBlock<Element>(channel))
+    {
+	SerializeContainer(channel, container, label);
+	return;
+    }
+
+    // the count, as SerializeContainer() writes it, then every element in one go
+    channel.startOfClass(ClassName(container).c_str(), label);
+
+    uint64_t element_count = container.size();
+    Serialize(channel, element_count, "count");
+
+    if (channel.get_direction() == Channel::OUT)
+	channel.serializeBlock(container.data(), container.size() * sizeof(Element), label);
+    else
+    {
+	// The count is only what the other end says. Room is made a chunk at a time as the elements arrive, so a wrong one runs out of
+	// data, and throws, long before it runs out of memory.
+	const uint64_t chunk = GREATER(SERIALIZE_BLOCK_CHUNK / sizeof(Element), static_cast<size_t>(1));
+
+	container.clear();
+
+	for (uint64_t done = 0; done < element_count;)
+	{
+	    const size_t amount = LESSER(element_count - done, chunk);
+
+	    container.resize(done + amount);
+	    channel.serializeBlock(container.data() + done, amount * sizeof(Element), label);
+	    done += amount;
+	}
+    }
+
+    channel.endOfClass(ClassName(container).c_str(), label);
+}
+
+template<typename Element> inline void Serialize(Channel& channel, std::vector<Element>& container, const char* label)
+{
+    SerializeVector(channel, container, label, SerializeAsBlock<Element>());
+}
+
+template<typename Element, size_t SIZE> inline void Serialize(Channel& channel, std::array<Element, SIZE>& container, const char* label)
+{
+    SerializeFixedArray(channel, container.data(), SIZE, ClassName(container).c_str(), label);
+}
+
+template<typename Element, size_t SIZE> inline void Serialize(Channel& channel, Element (&array)[SIZE], const char* label)
+{
+    // the arrays in a const serialize() are const
+    SerializeFixedArray(channel, const_cast<typename std::remove_const<Element>::type*>(array), SIZE, ClassName(array).c_str(), label);
+}
+
 template<typename Key, typename Value> inline void Serialize(Channel& channel, std::map<Key, Value>& container, const char* label)
 {
     SerializeContainer(channel, container, label);
@@ -650,3 +751,25 @@ template<typename OBJECT> OBJECT& RecvObject(const Channel& channel, OBJECT& obj
     SERIALIZE(const_cast<Channel&>(channel), object);
     return const_cast<OBJECT&> (object);
 }
+
+// RecvObject() waiting no more than timeout_milliseconds for each part of the object still to arrive, whatever the channel's own timeout.
+template<typename OBJECT> OBJECT& RecvObject(const Channel& channel, OBJECT& object, const int timeout_milliseconds)
+{
+    Channel& receiver = const_cast<Channel&>(channel);
+
+    const int previous = receiver.get_timeout_milliseconds();
+    receiver.set_timeout_milliseconds(timeout_milliseconds);
+
+    try
+    {
+	RecvObject(channel, object);
+    }
+    catch (...)
+    {
+	receiver.set_timeout_milliseconds(previous);
+	throw;
+    }
+
+    receiver.set_timeout_milliseconds(previous);
+    return object;
+}
@@ -8,6 +8,7 @@ $Id: Socket.h 2428 2012-08-14 15:33:13Z whoward $
 #include <Exception.h>
 #include <Text.h>
 #include <Misc.h>
+#include <EpollSet.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <unistd.h>
@@ -98,7 +99,7 @@ public:
 
     void Close()
     {
-        THROW_ON_ERROR(::close(fd));
+        THROW_ON_ERROR(EpollSet::Close(fd));
     }
 
     operator int()
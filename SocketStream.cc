@@ -10,6 +10,7 @@ $Id: SocketStream.cc 2428 2012-08-14 15:33:13Z whoward $
 #include <FileDescriptorStream.h>
 #include <SocketAddress.h>
 #include <SocketStream.h>
+#include <DatagramBatch.h>
 
 #ifdef __linux__
 #include <linux/sockios.h>
@@ -59,12 +60,12 @@ void SocketStream::SetOptions()
 
     Text broadcast = get_options().getValue("broadcast", 0);
 
-    if (not output_buffer_size.empty())
+    if (not broadcast.empty())
     {
-	int bufsize = atoi(output_buffer_size.c_str());
+	int on = atoi(broadcast.c_str());
 
 	THROW_ON_ERROR( setsockopt( get_write_fd(), SOL_SOCKET, SO_BROADCAST,
-				    (const char*)&bufsize, sizeof( bufsize )));
+				    (const char*)&on, sizeof( on )));
     }
 
     Text nagle_off = get_options().getValue("nagle_off", 0);
@@ -78,6 +79,45 @@ void SocketStream::SetOptions()
 
 }
 
+size_t SocketStream::receiveBatch(DatagramBatch& batch)
+{
+    if (improbable(get_read_fd() == -2))
+	open();
+
+    int received = batch.receive(get_read_fd());
+
+    if (improbable(received == -1))
+    {
+	// on a datagram socket this is some earlier peer that wasn't listening, not this socket failing
+	if (errno == ECONNREFUSED)
+	    throw(Exception(LOCATION, "Remote listener probably gone: %s", get_resource().c_str()));
+
+	set_fd_eof(true);
+	throw(Exception(LOCATION, "Error receiving datagrams on file descriptor %d from %s", get_read_fd(), get_resource().c_str()));
+    }
+
+    increment_read(batch.bytes(0, received));
+
+    return received;
+}
+
+size_t SocketStream::sendBatch(DatagramBatch& batch, const sockaddr* default_peer, const socklen_t default_peer_length)
+{
+    if (improbable(get_write_fd() == -2))
+	open();
+
+    const size_t first = batch.size() - batch.pending();
+
+    int sent = batch.send(get_write_fd(), default_peer, default_peer_length);
+
+    if (improbable(sent == -1))
+	throw(Exception(LOCATION, "Error sending datagrams on file descriptor %d to %s", get_write_fd(), get_resource().c_str()));
+
+    increment_written(batch.bytes(first, first + sent));
+
+    return sent;
+}
+
 /*
 SocketAddress SocketStream::localAddress() const
 {
@@ -127,5 +167,12 @@ void SocketStream::close()
 
 SocketStream::~SocketStream()
 {
-    close();
+    try
+    {
+	close();
+    }
+    catch (const std::exception& ex)
+    {
+	// a destructor can't throw. The descriptors are closed regardless.
+    }
 }
@@ -11,10 +11,18 @@ $Id: SocketStream.h 2428 2012-08-14 15:33:13Z whoward $
 #include <FileDescriptorStream.h>
 #include <SocketAddress.h>
 
+class DatagramBatch;
+
 class SocketStream: public FileDescriptorStream
 {
     unsigned _connect_timeout;
 
+protected:
+    // For the datagram streams' readBatch() and writeBatch(). Errors are handled as their read() and write() handle them.
+    size_t receiveBatch(DatagramBatch& batch);
+
+    size_t sendBatch(DatagramBatch& batch, const sockaddr* default_peer = NULL, const socklen_t default_peer_length = 0);
+
 public:
     GETSET(unsigned, _connect_timeout);
 
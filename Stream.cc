@@ -5,10 +5,221 @@ $Id: Stream.cc 2428 2012-08-14 15:33:13Z whoward $
 
 #include <Stream.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <BufferPool.h>
+#include <TimerWheel.h>
+
+namespace
+{
+    // milliseconds, cheaply. Only ever compared against periods of seconds.
+    uint64_t Now()
+    {
+        struct timespec now;
+        ::clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+        return static_cast<uint64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+    }
+}
+
+Stream::Buffer::Buffer(const size_t size) :
+    _buffer(NULL), _buffer_size(size), _read_buffer(NULL), _end(NULL),
+    _read_point(NULL), _insert_point(NULL), _mirrored(false), _mapped(0), _scanned(0),
+    _base_size(size), _max_size(1 << 20), _idle_milliseconds(10000), _grown_at(0), _filled_at(0)
+{
+}
+
+void Stream::Buffer::allocate(const size_t size)
+{
+    BufferPool::Block block = BufferPool::Acquire(size);
+
+    _buffer = block._data;
+    _buffer_size = block._size;
+    _mirrored = block._mirrored;
+
+    _read_buffer = _buffer;
+    _end = _buffer + _buffer_size;
+    _read_point = _buffer;
+    _insert_point = _buffer;
+    _scanned = 0;
+    *_end = '\0';
+    *_buffer = '\0';
+}
+
+void Stream::Buffer::release()
+{
+    if (not _buffer)
+        return;
+
+    if (improbable(_mapped))
+    {
+        ::munmap(_buffer, _mapped + 1);
+        _mapped = 0;
+        _buffer_size = _base_size;
+    }
+    else
+    {
+        BufferPool::Block block = { _buffer, _buffer_size, _mirrored };
+        BufferPool::Release(block);
+    }
+
+    _buffer = NULL;
+    _read_buffer = NULL;
+    _end = NULL;
+    _read_point = NULL;
+    _insert_point = NULL;
+    _scanned = 0;
+}
+
+void Stream::Buffer::adopt(char* data, const size_t length)
+{
+    release();
+
+    _buffer = data;
+    _buffer_size = length;
+    _mapped = length;
+    _mirrored = false;
+    _grown_at = 0;
+
+    _read_buffer = _buffer;
+    _end = _buffer + length;
+    _read_point = _buffer;
+    _insert_point = _end; // the null after the mapping ends it like any other buffer. Nothing is written here, it's read only.
+    _scanned = 0;
+    _filled_at = Now();
+}
+
+void Stream::Buffer::Flush()
+{
+    release();
+}
+
+size_t Stream::Buffer::room() const
+{
+    if (not _buffer or _mapped)
+        return 0;
+
+    // the ring can hold everything except the byte reserved for the terminating null
+    if (_mirrored)
+        return _buffer_size - unread() - 1;
+
+    return _end - _insert_point - 1;
+}
+
+void Stream::Buffer::prepare()
+{
+    if (improbable(not _buffer))
+        allocate(_buffer_size);
+
+    if (_mirrored)
+    {
+        // Nothing moves. Once the reader has wandered into the second copy, step both pointers back into the first
+        // so new data always lands inside the mapping.
+        if (not unread())
+            _read_point = _insert_point = _buffer;
+        else if (_read_point >= _end)
+        {
+            _read_point -= _buffer_size;
+            _insert_point -= _buffer_size;
+        }
+    }
+    else
+    {
+        // move any remaining junk to the beginning of the buffer in prepartion for refilling the buffer
+        size_t length = unread(); // how much buffer do we have left unread?
+        ::memmove(_read_buffer, _read_point, length); //move it to the beginning of the buffer space.
+        _read_point = _read_buffer; // also adjust the readpoint
+        _insert_point = _read_point + length; // new data will be inserted right after the old unread text in the buffer
+    }
+
+    *_insert_point = '\0'; // prevent reading past the insert_point (if not wraparound bugs can occur)
+}
+
+void Stream::Buffer::resize(const size_t new_size)
+{
+    if (not _buffer)
+    {
+        _buffer_size = new_size;
+        return;
+    }
+
+    // carry the unread data over to the new storage, as much as fits.
+    BufferPool::Block old_block = { _buffer, _buffer_size, _mirrored };
+    const size_t old_mapped = _mapped;
+    const char* unread_data = _read_point;
+    size_t length = unread();
+
+    _mapped = 0;
+    allocate(new_size);
+
+    length = std::min(length, room());
+    ::memcpy(_insert_point, unread_data, length);
+    _insert_point += length;
+    *_insert_point = '\0';
+
+    if (old_mapped)
+        ::munmap(old_block._data, old_mapped + 1);
+    else
+        BufferPool::Release(old_block);
+}
+
+void Stream::Buffer::settle()
+{
+    if (Now() - _grown_at >= _idle_milliseconds)
+    {
+        resize(_base_size);
+        _grown_at = 0;
+    }
+}
+
+bool Stream::Buffer::grow()
+{
+    const size_t size = std::min(_buffer_size * 2, std::max(_max_size, _base_size));
+
+    if (size <= _buffer_size)
+        return false;
+
+    resize(size);
+    _grown_at = Now();
+
+    return true;
+}
+
+void Stream::Buffer::idle()
+{
+    if (_buffer and Now() - _filled_at >= _idle_milliseconds)
+        shrink();
+}
+
+void Stream::Buffer::shrink()
+{
+    if (not unread())
+    {
+        release();
+        _buffer_size = _base_size;
+        _grown_at = 0;
+        return;
+    }
+
+    // a mapping's pages are the file's, the kernel can drop them whenever it likes
+    if (_mapped)
+        return;
+
+    // the smallest pooled size that holds it, and the terminating null
+    size_t size = 1 << BufferPool::SMALLEST_SHIFT;
+    while (size < unread() + 1)
+        size *= 2;
+
+    if (size < _buffer_size)
+        resize(size);
+}
+
+Stream::Buffer::~Buffer()
+{
+    release();
+}
 
 Stream::Stream(const char* resource, const char* options, const int size) :
     _options(NO_NULL_STR(options)), _option_string(NO_NULL_STR(options)),_resource(NO_NULL_STR(resource)),
-    _buffer(new Buffer(size)), _debug_file(-1)
+    _buffer(new Buffer(size)), _gcount(0), _debug_file(-1), _datagrams(false)
 {
     const char* debug = getenv("STREAM_MONITOR");
 
@@ -19,6 +230,84 @@ Stream::Stream(const char* resource, const char* options, const int size) :
 
         THROW_ON_ERROR(_debug_file);
     }
+
+    configureOutput();
+    configureBuffer();
+}
+
+void Stream::set_datagrams()
+{
+    _datagrams = true;
+    configureOutput(); // the constructor gave it a write buffer before it knew
+}
+
+void Stream::mapBuffer(char* data, const size_t length)
+{
+    _buffer->adopt(data, length);
+}
+
+void Stream::configureBuffer()
+{
+    const Text& max = _options.getValue("BUFFER_MAX");
+    if (not max.empty())
+        _buffer->_max_size = ::strtoul(max.c_str(), NULL, 0);
+
+    const Text& idle = _options.getValue("BUFFER_IDLE");
+    if (not idle.empty())
+        _buffer->_idle_milliseconds = ::strtoul(idle.c_str(), NULL, 0);
+}
+
+unsigned Stream::linger() const
+{
+    const Text& linger = _options.getValue("LINGER");
+    if (linger.empty())
+        return _queue ? 0 : DEFAULT_LINGER; // a queued stream is usually run from a Reactor, which must not sit waiting on one peer
+
+    return ::strtoul(linger.c_str(), NULL, 0);
+}
+
+void Stream::configureOutput()
+{
+    const Text& wbuf = _options.getValue("WBUF");
+    const size_t size = wbuf.empty() or _datagrams ? 0 : ::strtoul(wbuf.c_str(), NULL, 0);
+
+    if (size != (_output ? _output->_size : 0))
+    {
+        if (_output and _output->_used)
+            flush();
+
+        _output.reset(size ? new OutputBuffer(size) : NULL);
+    }
+
+    const Text& queue = _options.getValue("QUEUE");
+    const size_t high_water = queue.empty() ? 0 : ::strtoul(queue.c_str(), NULL, 0);
+
+    if (not high_water)
+    {
+        // nowhere to keep what is left any more. It goes now, as long as the other end takes it in time.
+        const Deadline deadline(linger());
+
+        while (queuedOutput())
+        {
+            drainQueue();
+
+            if (queuedOutput() and (deadline.expired() or not isWriteReady(deadline.remaining())))
+                throw Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "%zu bytes still queued to %s after %u milliseconds, dropping QUEUE",
+                                queuedOutput(), _resource.c_str(), linger());
+        }
+
+        _queue.reset();
+        return;
+    }
+
+    const Text& low = _options.getValue("LOW_WATER");
+    const size_t low_water = low.empty() ? high_water / 4 : ::strtoul(low.c_str(), NULL, 0);
+
+    if (not _queue)
+        _queue.reset(new OutputQueue(high_water, low_water));
+
+    _queue->_high_water = high_water;
+    _queue->_low_water = low_water;
 }
 
 
@@ -31,12 +320,17 @@ void Stream::open(const char* resource, const char* options)
     {
 	_option_string = options;
 	_options.loadFromNameValuePairs(options);
+	configureOutput();
+	configureBuffer();
     }
 }
 
 
 void Stream::close()
 {
+    // copies of a stream share its buffer
+    if (_buffer.unique())
+        _buffer->release();
 }
 
 
@@ -46,8 +340,264 @@ Stream* Stream::accept()
 }
 
 
+size_t Stream::writeVector(const struct iovec* vector, const int count)
+{
+    size_t total(0);
+
+    for (int i = 0; i < count; ++i)
+    {
+        size_t written = write(vector[i].iov_len, static_cast<const char*>(vector[i].iov_base));
+
+        total += written;
+
+        if (written < vector[i].iov_len)
+            break;
+    }
+
+    return total;
+}
+
+void Stream::enqueue(const struct iovec* vector, const int count)
+{
+    OutputQueue& queue = *_queue;
+
+    if (queue.size())
+        drainQueue();
+
+    // nothing may overtake what is still queued
+    size_t written = (queue.size() or not count) ? 0 : writeVector(vector, count);
+
+    const bool was_empty = not queue.size();
+
+    for (int i = 0; i < count; ++i)
+    {
+        if (written >= vector[i].iov_len)
+        {
+            written -= vector[i].iov_len;
+            continue;
+        }
+
+        queue._data.append(static_cast<const char*>(vector[i].iov_base) + written, vector[i].iov_len - written);
+        written = 0;
+    }
+
+    if (was_empty and queue.size() and _on_queued)
+        _on_queued(this);
+
+    if (not queue._above and queue.size() > queue._high_water)
+    {
+        queue._above = true;
+
+        if (_on_high_water)
+            _on_high_water(this);
+    }
+}
+
+void Stream::drainQueue()
+{
+    OutputQueue& queue = *_queue;
+
+    while (queue.size())
+    {
+        struct iovec piece = { const_cast<char*>(queue._data.data()) + queue._sent, queue.size() };
+
+        const size_t written = writeVector(&piece, 1);
+
+        if (not written)
+            break;
+
+        queue._sent += written;
+    }
+
+    if (not queue.size())
+    {
+        // don't hang on to the memory a burst needed
+        if (queue._data.capacity() > queue._high_water)
+            std::string().swap(queue._data);
+        else
+            queue._data.clear();
+
+        queue._sent = 0;
+    }
+    else if (queue._sent > queue._data.size() / 2)
+    {
+        queue._data.erase(0, queue._sent);
+        queue._sent = 0;
+    }
+
+    if (queue._above and queue.size() <= queue._low_water)
+    {
+        queue._above = false;
+
+        if (_on_low_water)
+            _on_low_water(this);
+    }
+}
+
+void Stream::sendOutput(const struct iovec* vector, const int count, int milliseconds_to_wait)
+{
+    // anything pending in the write buffer goes out ahead of the new pieces, all in the same writeVector() calls
+    struct iovec local[8];
+    std::vector<struct iovec> large;
+    struct iovec* next = local;
+
+    if (count >= 8)
+    {
+        large.resize(count + 1);
+        next = &large[0];
+    }
+
+    int remaining(0);
+
+    if (_output and _output->_used)
+    {
+        next[remaining].iov_base = _output->_data;
+        next[remaining++].iov_len = _output->_used;
+    }
+
+    for (int i = 0; i < count; ++i)
+        if (vector[i].iov_len)
+            next[remaining++] = vector[i];
+
+    // with an output queue nothing waits. What doesn't go now is queued.
+    if (_queue)
+    {
+        enqueue(next, remaining);
+
+        if (_output)
+            _output->_used = 0;
+
+        return;
+    }
+
+    while (remaining)
+    {
+	if (milliseconds_to_wait and !isWriteReady(milliseconds_to_wait))
+	    throw(Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "Failed to write after %d milli-second timeout to %s", milliseconds_to_wait, _resource.c_str()));
+
+        size_t written = writeVector(next, remaining);
+
+        // nothing went. Wait for room instead of trying again straight away.
+        if (not written and not milliseconds_to_wait)
+            isWriteReady(1000);
+
+        // step past whatever went out completely, and into the piece that went out partially
+        while (remaining and written >= next->iov_len)
+        {
+            written -= next->iov_len;
+            ++next, --remaining;
+        }
+
+        if (remaining)
+        {
+            next->iov_base = static_cast<char*>(next->iov_base) + written;
+            next->iov_len -= written;
+        }
+    }
+
+    if (_output)
+        _output->_used = 0;
+}
+
+size_t Stream::writeAllVector(const struct iovec* vector, const int count, int milliseconds_to_wait)
+{
+    size_t total(0);
+
+    for (int i = 0; i < count; ++i)
+        total += vector[i].iov_len;
+
+    if (_output and _output->_used + total <= _output->_size)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            ::memcpy(_output->_data + _output->_used, vector[i].iov_base, vector[i].iov_len);
+            _output->_used += vector[i].iov_len;
+        }
+    }
+    else
+        sendOutput(vector, count, milliseconds_to_wait);
+
+    if (_debug_file > -1)
+        for (int i = 0; i < count; ++i)
+            THROW_ON_ERROR(::write(_debug_file, vector[i].iov_base, vector[i].iov_len));
+
+    return total;
+}
+
+size_t Stream::readVector(const struct iovec* vector, const int count)
+{
+    size_t total(0);
+
+    for (int i = 0; i < count; ++i)
+    {
+        size_t amount = read(vector[i].iov_len, static_cast<char*>(vector[i].iov_base));
+
+        total += amount;
+
+        if (amount < vector[i].iov_len)
+            break;
+    }
+
+    return total;
+}
+
+size_t Stream::readAllVector(const struct iovec* vector, const int count)
+{
+    size_t total(0);
+
+    for (int i = 0; i < count; ++i)
+        total += vector[i].iov_len;
+
+    View available = peek(total);
+
+    if (not available)
+        return 0;
+
+    const char* source = available.data;
+
+    for (int i = 0; i < count; ++i)
+    {
+        ::memcpy(vector[i].iov_base, source, vector[i].iov_len);
+        source += vector[i].iov_len;
+    }
+
+    _buffer->consume(total);
+
+    return total;
+}
+
 size_t Stream::writeAll(const size_t total_amount,  const char* const original_source, int milliseconds_to_wait)
 {
+    if (_output)
+    {
+        if (_output->_used + total_amount <= _output->_size)
+        {
+            ::memcpy(_output->_data + _output->_used, original_source, total_amount);
+            _output->_used += total_amount;
+        }
+        else
+        {
+            struct iovec piece = { const_cast<char*>(original_source), total_amount };
+            sendOutput(&piece, 1, milliseconds_to_wait);
+        }
+
+        if (_debug_file > -1)
+            THROW_ON_ERROR(::write(_debug_file, original_source, total_amount));
+
+        return total_amount;
+    }
+
+    if (_queue)
+    {
+        struct iovec piece = { const_cast<char*>(original_source), total_amount };
+        enqueue(&piece, 1);
+
+        if (_debug_file > -1)
+            THROW_ON_ERROR(::write(_debug_file, original_source, total_amount));
+
+        return total_amount;
+    }
+
     size_t amount(total_amount);
     const char* source(original_source);
 
@@ -63,6 +613,10 @@ size_t Stream::writeAll(const size_t total_amount,  const char* const original_s
                 THROW_ON_ERROR(::write(_debug_file, original_source, total_amount));
             return total_amount;
         }
+
+        // nothing went. Wait for room instead of trying again straight away.
+        if (not rval and not milliseconds_to_wait)
+            isWriteReady(1000);
         amount -= rval;
         source += rval;
     } while(amount > 0);
@@ -75,30 +629,46 @@ size_t Stream::writeAll(const size_t total_amount,  const char* const original_s
 
 size_t Stream::Printf(const char* format, ...)
 {
-    size_t bufsize(4096);
+    // Straight into the write buffer if there is one with room, otherwise onto the stack and out from there.
+    char local[4096];
+    char* destination = local;
+    size_t room = sizeof(local);
 
-    for (;;)
+    if (_output and _output->_size - _output->_used > sizeof(local))
     {
-        char* const output_buffer(reinterpret_cast<char *> (::alloca(bufsize)));
-        va_list args;
-        va_start(args, format);
-        const int written = ::vsnprintf(output_buffer, bufsize, format, args);
-        va_end(args);
+        destination = _output->_data + _output->_used;
+        room = _output->_size - _output->_used;
+    }
 
-        // If there was insufficient room, set size to what is needed and try again
-        // if vsnprintf fails it returns the number of bytes NEEDED so we can try again and succeed
-        if (written >= static_cast<int> (bufsize))
-        {
-            bufsize = written + 1;
-            continue;
-        }
+    va_list args;
+    va_start(args, format);
+    const int written = ::vsnprintf(destination, room, format, args);
+    va_end(args);
 
-        if (written < 0)
-            throw(Exception(LOCATION, "Error writing printf style output"));
+    if (written < 0)
+        throw(Exception(LOCATION, "Error writing printf style output"));
 
-        writeAll(written, output_buffer);
+    // vsnprintf says how much room it needed, so one more try always does it
+    if (written >= static_cast<int>(room))
+    {
+        char* const larger(reinterpret_cast<char*>(::alloca(written + 1)));
+        va_start(args, format);
+        ::vsnprintf(larger, written + 1, format, args);
+        va_end(args);
+
+        writeAll(written, larger);
         return written;
     }
+
+    if (destination == local)
+        return writeAll(written, local);
+
+    _output->_used += written;
+
+    if (_debug_file > -1)
+        THROW_ON_ERROR(::write(_debug_file, destination, written));
+
+    return written;
 }
 
 size_t Stream::writeString(const Text& write_me)
@@ -107,64 +677,79 @@ size_t Stream::writeString(const Text& write_me)
 }
 
 
-namespace {
-
-inline char* memsrch(void* memory, const char* str, size_t length)
+const char* Stream::findDelimiter(const Stream::DelimiterList& delimiters, size_t& which)
 {
-    int checklen = strlen(str);
-    const char* end = reinterpret_cast<char*>(memory) + length - checklen + 1;
-    for(char* s = reinterpret_cast<char*>(memory); s < end; ++s)
-    {
-	if (probable(*s != *str)) // not even a beginning of a match, go to next
-	    continue;
+    if (_buffer->_search.compile(delimiters))
+	_buffer->_scanned = 0;
 
-	// potential match? check it.
-	if (probable(not strncmp(str, s, checklen)))
-	    return reinterpret_cast<char*>(s);
-    }
+    // a delimiter may have been cut off at the end of the last search, so back up over where it could have started
+    const size_t overhang = _buffer->_search.get_longest() - 1;
+    const size_t resume = _buffer->_scanned > overhang ? _buffer->_scanned - overhang : 0;
 
-    return 0;
-}
+    const char* found = _buffer->_search.find(_buffer->_read_point + resume, _buffer->_insert_point, which);
 
-}
+    _buffer->_scanned = (found ? found : _buffer->_insert_point) - _buffer->_read_point;
 
+    return found;
+}
 
 const char* Stream::FirstDelimiter(const Stream::DelimiterList& delimiters)
 {
-    const char* first_delimiter(NULL);
-
-    for (Stream::DelimiterList::const_iterator delimiter(delimiters.begin()); delimiter
-            != delimiters.end(); ++delimiter)
-    {
-	const char* read_point = _buffer->_read_point;
-	const char* insert_point = _buffer->_insert_point;
-        const char* next_delimiter = ::memsrch(_buffer->_read_point, *delimiter, _buffer->_insert_point - _buffer->_read_point); // find the delimiter
-        if (next_delimiter)
-            if (next_delimiter < first_delimiter or not first_delimiter)
-                first_delimiter = *delimiter;
-    }
-    // first element points to WHERE the the delimiter is, second points to the delimiter TEXT that we found. There is a difference.
-    // if we are looking for "proto" we find it in "good protoplasm". first points to the "p" in protoplasm, second points to the Text.c_str() "proto"
-    return first_delimiter;
+    size_t which;
+    return findDelimiter(delimiters, which) ? delimiters[which] : NULL;
 }
 
 size_t Stream::fillBuffer()
 {
-    // move any remaining junk to the beginning of the buffer in prepartion for refilling the buffer
-    int length(_buffer->_insert_point - _buffer->_read_point); // how much buffer do we have left unread?
-    ::memmove(_buffer->_read_buffer, _buffer->_read_point, length); //move it to the beginning of the buffer space.
-    _buffer->_read_point = _buffer->_read_buffer; // also adjust the readpoint
-    _buffer->_insert_point = _buffer->_read_point + length; // new data will be inserted right after the old unread text in the buffer
-    *_buffer->_insert_point = '\0'; // prevent reading past the insert_point (if not wraparound bugs can occur)
+    // what we are about to read may be a reply to what is still sitting in the write buffer, so send that first
+    if (improbable(pendingOutput()))
+        flush();
+
+    // everything there was when it was mapped is buffered already. The resource carries on from the end of the mapping, so ask it
+    // for one byte: nothing means the end (and the read notes it), anything means the file grew and the rest goes in pooled storage.
+    if (improbable(_buffer->_mapped))
+    {
+	char next;
+	if (not this->read(1, &next))
+	    return 0;
+
+	size_t size = 1 << BufferPool::SMALLEST_SHIFT;
+	while (size < _buffer->unread() + 2)
+	    size *= 2;
+
+	_buffer->resize(size);
+	*_buffer->_insert_point++ = next;
+	*_buffer->_insert_point = '\0';
+	_buffer->_filled_at = Now();
+
+	return 1 + fillBuffer();
+    }
+
+    _buffer->prepare();
 
-    int read_attempt = _buffer->_end - _buffer->_insert_point - 1;
+    int read_attempt = _buffer->room();
 
-    int amount_read = this->read(read_attempt, _buffer->_insert_point); // try to completely fill the buffer;
+    int amount_read;
+
+    try
+    {
+	amount_read = this->read(read_attempt, _buffer->_insert_point); // try to completely fill the buffer;
+    }
+    catch (...)
+    {
+	_buffer->drained();
+	throw;
+    }
 
     if (0 == amount_read) // if nothing available to read, return "no string"
+    {
+	_buffer->drained(); // an idle stream holds no storage
+	_buffer->idle(); // or only what its partial message needs
         return 0;
+    }
 
     _buffer->_insert_point += amount_read; // adjust insertion point
+    _buffer->_filled_at = Now();
 
     *_buffer->_insert_point = '\0'; // prevent reading past the insert_point (if not wraparound bugs can occur)
 
@@ -173,45 +758,106 @@ size_t Stream::fillBuffer()
 
 size_t Stream::readAll(size_t amount, char* destination)
 {
-    if (_buffer->_insert_point - _buffer->_read_point < static_cast<int>(amount))
-        fillBuffer();
+    View available = peek(amount);
 
-    if (_buffer->_insert_point - _buffer->_read_point < static_cast<int>(amount))
+    if (not available)
         return 0;
 
-    ::memcpy(destination, _buffer->_read_point, amount);
-    _buffer->_read_point += amount;
+    ::memcpy(destination, available.data, amount);
+    _buffer->consume(amount);
 
     return amount;
 }
 
+size_t Stream::readAllWithTimeout(const size_t amount, char* destination, const int timeout_milliseconds)
+{
+    static const size_t DirectRead = 65536; // reads this big skip the buffer
+
+    if (probable(buffered() >= amount)) // the usual case, and no need to look at the clock for it
+    {
+	::memcpy(destination, _buffer->_read_point, amount);
+	_buffer->consume(amount);
+	return amount;
+    }
+
+    const Deadline deadline(GREATER(timeout_milliseconds, 0));
+
+    size_t done = 0;
+
+    while (done < amount)
+    {
+	const size_t wanted = amount - done;
+
+	if (not buffered() and wanted < DirectRead)
+	    fillBuffer();
+
+	if (const size_t taken = MIN(buffered(), wanted))
+	{
+	    ::memcpy(destination + done, _buffer->_read_point, taken);
+	    _buffer->consume(taken);
+	    done += taken;
+	    continue;
+	}
+
+	if (wanted >= DirectRead)
+	    if (const size_t got = read(wanted, destination + done))
+	    {
+		done += got;
+		continue;
+	    }
+
+	if (eof())
+	    break;
+
+	// nothing is buffered now, so this waits for the resource itself
+	if (timeout_milliseconds < 0)
+	    isReadReady(1000);
+	else if (not isReadReady(deadline.remaining()) and deadline.expired())
+	    break;
+    }
+
+    return done;
+}
+
+Stream::View Stream::peek(const size_t amount)
+{
+    if (_buffer->unread() < amount)
+        fillBuffer();
+
+    if (_buffer->unread() < amount)
+        return View();
+
+    return View(_buffer->_read_point, amount, amount);
+}
+
+size_t Stream::consume(const size_t amount)
+{
+    size_t removed = MIN(amount, _buffer->unread());
+    _buffer->consume(removed);
+    return removed;
+}
+
 Text Stream::readString(const size_t max_length)
 {
-    char* buffer = (char*) alloca(max_length + 1);
-    char* p = buffer;
-    size_t total_read(0);
+    Text rval;
 
-    while(total_read < max_length and not eof())
+    while(rval.size() < max_length and not eof())
     {
 	// if there is less than max_length in the buffer, try to get some more.
-	if (_buffer->_insert_point - _buffer->_read_point < static_cast<int>(max_length))
+	if (_buffer->unread() < max_length)
 	    fillBuffer();
 
-	size_t amount = MIN((_buffer->_insert_point - _buffer->_read_point), (max_length - total_read));
+	size_t amount = MIN(_buffer->unread(), (max_length - rval.size()));
 
 	if (not amount)
 	    break;
 
-	::memcpy(p, _buffer->_read_point, amount);
-
-	p += amount;
+	rval.append(_buffer->_read_point, amount);
 
-	total_read += amount;
-
-	_buffer->_read_point += amount;
+	_buffer->consume(amount);
     }
 
-    return Text(buffer, total_read);
+    return rval;
 }
 
 size_t Stream::relay(const size_t atmost, Stream* output, const char* delimiter,
@@ -240,7 +886,7 @@ size_t Stream::relay(const size_t atmost, Stream* output, const char* delimiter,
 
 		amount = output->writeAll(amount, _buffer->_read_point);
 
-		_buffer->_read_point += amount;
+		_buffer->consume(amount);
 
 		return amount;
 	    }
@@ -250,33 +896,83 @@ size_t Stream::relay(const size_t atmost, Stream* output, const char* delimiter,
     return 0;
 }
 
-Text Stream::readToDelimiterStrings(const DelimiterList& delimiters,
+size_t Stream::transferTo(Stream& out, const size_t max)
+{
+    // what out has waiting in its write buffer was written before this
+    if (out.pendingOutput())
+    {
+	out.flush();
+
+	if (out.pendingOutput())
+	    return 0;
+    }
+
+    if (not buffered())
+	fillBuffer();
+
+    const size_t amount = MIN(buffered(), max);
+
+    if (not amount)
+	return 0;
+
+    const size_t written = out.write(amount, _buffer->_read_point);
+    _buffer->consume(written);
+
+    return written;
+}
+
+Stream::View Stream::peekToDelimiters(const DelimiterList& delimiters,
         const Stream::OPTIONS options)
 {
-    const char* first_delimiter = FirstDelimiter(delimiters);
+    size_t which(0);
+    const char* found = findDelimiter(delimiters, which);
 
-    if (not first_delimiter) // if there is no delimiter in the buffer, read in some new stuff
+    if (not found) // if there is no delimiter in the buffer, read in some new stuff
     {
         if (not fillBuffer())
-            return ""; // no new data, return immediately
+            return View(); // no new data, return immediately
 
         // Try again to find a best delimiter
-        first_delimiter = FirstDelimiter(delimiters);
+        found = findDelimiter(delimiters, which);
 
-        if (not first_delimiter)
-	{
-	    int length = _buffer->_end - _buffer->_insert_point;
-	    if (length < 2) // No delimiter read yet, no more room left in buffer, throw
+        // No delimiter read yet and no more room left in the buffer: make it bigger while we can
+        while (not found and not _buffer->room())
+        {
+            if (not _buffer->grow())
                 throw(Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "No delimiter within entire buffer size %ld", _buffer->get_buffer_size()));
-	    return "";
+
+            if (not fillBuffer())
+                return View();
+
+            found = findDelimiter(delimiters, which);
         }
+
+        if (not found)
+	    return View();
     }
 
-    char* rval_start = _buffer->_read_point;
-    _buffer->_read_point = ::memsrch(_buffer->_read_point, first_delimiter, _buffer->_insert_point - _buffer->_read_point);
-    _buffer->_read_point += ::strlen(first_delimiter); // skip past the delimiter
-    return Text(rval_start, _buffer->_read_point - rval_start - (options
-            & Stream::INCLUDE_DELIMITER ? 0 : strlen(first_delimiter)));
+    const size_t delimiter_length = _buffer->_search.delimiter(which).size();
+    const size_t length = found - _buffer->_read_point;
+    return View(_buffer->_read_point, length + (options & Stream::INCLUDE_DELIMITER ? delimiter_length : 0), length + delimiter_length);
+}
+
+Stream::View Stream::peekToDelimiter(const char* delimiter,
+        const Stream::OPTIONS options)
+{
+    return peekToDelimiters(DelimiterList(1, delimiter), options);
+}
+
+Text Stream::readToDelimiterStrings(const DelimiterList& delimiters,
+        const Stream::OPTIONS options)
+{
+    View found = peekToDelimiters(delimiters, options);
+
+    if (not found)
+        return "";
+
+    Text rval(found.data, found.size);
+    _buffer->consume(found.extent); // skip past the delimiter
+    return rval;
 }
 
 bool Stream::hasBuffered() const
@@ -306,6 +1002,18 @@ Text Stream::readToDelimiterString(const char* delimiter,
 }
 
 void Stream::flush()
+{
+    if (pendingOutput())
+        sendOutput(NULL, 0);
+}
+
+void Stream::flushWithin(const unsigned milliseconds)
+{
+    if (pendingOutput())
+        sendOutput(NULL, 0, GREATER(milliseconds, 1u)); // 0 would be no limit
+}
+
+void Stream::discardBuffered()
 {
     _buffer->Flush();
 }
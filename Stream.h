@@ -8,20 +8,42 @@ $Id: Stream.h 2428 2012-08-14 15:33:13Z whoward $
 #include <MiniConfig.h>
 #include <Exception.h>
 #include <Misc.h>
+#include <DelimiterSearch.h>
+#include <NumberFormat.h>
 #include <unistd.h>
+#include <sys/uio.h>
 #include <alloca.h>
 #include <cstdarg>
 #include <cstdio>
 #include <ostream>
 #include <vector>
 #include <sstream>
+#include <stdint.h>
 #include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
+#include <string>
 
 /**
    Abstract base (which includes some actual functionality) for all Streamlike entities.
 */
 class Stream
 {
+    /**
+       Read buffer. The storage is a "magic ring", one memfd mapped twice back to back, so the unread data between _read_point and
+       _insert_point is always contiguous even when it wraps past _end. Refilling therefore never has to move unread data to the front.
+       If the double mapping cannot be made, it falls back to plain heap storage compacted with memmove like it always was.
+       Storage comes from the BufferPool when data is read, and goes back to it whenever everything read has been consumed, so
+       write only and idle streams don't hold any.
+
+       The size adapts. When a delimiter is looked for and the buffer fills up without one, it doubles, up to BUFFER_MAX=bytes
+       (1 MB by default), instead of giving up. Once it has been BUFFER_IDLE=milliseconds (10 seconds by default) since it grew, it
+       drops back to the size the stream was made with the next time it is drained. A buffer left holding part of a message for
+       that long with nothing new arriving is cut down to the smallest size that holds what is there.
+
+       A stream can also hand it a read only mapping of a file (DiskFileStream's MMAP option) as though it had all just been read. Nothing
+       more is read into it. A read past its end that finds the file has grown moves what is unread into pooled storage, and so does
+       consuming all of it.
+    */
     struct Buffer
     {
         char* _buffer;
@@ -30,45 +52,129 @@ class Stream
         char* _end; // points to one past end of _buffer
         char* _read_point; // consumer of data will read from here.
         char* _insert_point; // new data arriving from stream will be put starting here.
+        bool _mirrored; // _buffer is followed by a second mapping of itself
+        size_t _mapped; // _buffer is a file mapping this long rather than pooled storage
+
+        DelimiterSearch _search; // the delimiters last looked for
+        size_t _scanned; // how much past _read_point has already been searched for them without finding one
+
+        size_t _base_size; // what the stream asked for. Grown buffers return to this.
+        size_t _max_size;
+        unsigned _idle_milliseconds;
+        uint64_t _grown_at; // when the buffer last grew, 0 if it is back to _base_size
+        uint64_t _filled_at; // when data last arrived
 
         GETSET(size_t, _buffer_size);
 
-	void Flush()
-	{
-	    _read_buffer = _buffer;
-	    _read_point  = _buffer;
-	    _insert_point = _buffer;
-	    _buffer[0] = '\0';
-	}
+	void Flush();
 
-        Buffer(const size_t size) :
-            _buffer(new char[2]), _buffer_size(2), _read_buffer(_buffer),
-	    _read_point(_buffer), _insert_point(_buffer)
+        Buffer(const size_t size);
+
+        // how much has been read into the buffer but not yet consumed
+        size_t unread() const
         {
-            _buffer[0] = '\0';
-            resize(size);
+            return _insert_point - _read_point;
         }
 
-        void resize(const size_t new_size)
+        // the consumer has used up amount bytes
+        void consume(const size_t amount)
         {
-            char* new_buffer = new char[new_size + 1];
-            ::memcpy(new_buffer, _buffer, std::min(_buffer_size, new_size));
-            _read_buffer = new_buffer;
-            _end = new_buffer + new_size;
-            _read_point = new_buffer + (_read_point - _buffer);
-            _insert_point = new_buffer + (_insert_point - _buffer);
-            *_end = '\0';
-            *_read_buffer = '\0';
-            delete[] _buffer;
-            _buffer = new_buffer;
-            _buffer_size = new_size;
+            _read_point += amount;
+            _scanned = 0;
+            drained();
         }
 
-        ~Buffer()
+        // give the storage back if nothing is left in it
+        void drained()
         {
-            delete[] _buffer;
+            if (_read_point == _insert_point)
+            {
+                release();
+
+                if (improbable(_grown_at))
+                    settle();
+            }
         }
 
+        // back to _base_size if it is long enough since the buffer grew
+        void settle();
+
+        // double the size, up to _max_size. false if it is already there.
+        bool grow();
+
+        // if nothing has arrived for _idle_milliseconds, move what is unread into the smallest buffer it fits in
+        void idle();
+
+        // move what is unread into the smallest buffer it fits in, or give the storage back if there is nothing
+        void shrink();
+
+        // how much new data can be inserted at _insert_point (one byte is always kept for a terminating null)
+        size_t room() const;
+
+        // make room for new data at _insert_point, obtaining storage if there is none yet.
+        void prepare();
+
+        void resize(const size_t new_size);
+
+        // return the storage to the pool, and anything unread with it
+        void release();
+
+        // use length bytes of a read only mapping as the storage, all of them unread
+        void adopt(char* data, const size_t length);
+
+        ~Buffer();
+
+    private:
+        void allocate(const size_t size);
+    };
+
+    /**
+       Write buffer, only present when the WBUF=<bytes> option is given. Small writes are copied in here and go out together when
+       the next one would take it past its size, on flush(), or before the stream reads. A write that doesn't fit goes out along with
+       whatever is pending in one writeVector() call. Only for byte streams: datagram streams (set_datagrams()) never have one, since
+       their messages would be merged.
+    */
+    struct OutputBuffer
+    {
+        char* _data;
+        size_t _size;
+        size_t _used;
+
+        OutputBuffer(const size_t size) : _data(new char[size]), _size(size), _used(0)
+        {
+        }
+
+        ~OutputBuffer()
+        {
+            delete[] _data;
+        }
+    };
+
+    /**
+       Output queue, only present when the QUEUE=<bytes> option is given. What the stream can't take right now is kept here, in order,
+       and writeAll() returns at once instead of spinning until the other end catches up. It goes out ahead of anything written later,
+       on flush(), before reads, and when a Reactor the stream is registered with finds it writable. The size given is the high water
+       mark: once more than that is queued the OnHighWater handler is called, so the producer can hold off, and once it has drained to
+       LOW_WATER=<bytes> (a quarter of QUEUE by default) OnLowWater is called so it can carry on. The queue itself has no limit.
+       Dropping the QUEUE option, or closing, sends what is queued first, waiting up to LINGER=<milliseconds> for the other end to take
+       it, and throws if it doesn't. With QUEUE, LINGER is 0 unless given: what the other end won't take straight away is dropped.
+    */
+    struct OutputQueue
+    {
+        std::string _data;
+        size_t _sent; // how much from the front of _data has gone out
+        size_t _high_water;
+        size_t _low_water;
+        bool _above; // went over _high_water and hasn't come back down to _low_water yet
+
+        OutputQueue(const size_t high_water, const size_t low_water) : _sent(0), _high_water(high_water), _low_water(low_water), _above(false)
+        {
+        }
+
+        size_t size() const
+        {
+            return _data.size() - _sent;
+        }
     };
 
     MiniConfig _options;
@@ -79,11 +185,62 @@ class Stream
 
     boost::shared_ptr<Buffer> _buffer;
 
+    boost::shared_ptr<OutputBuffer> _output;
+
+    boost::shared_ptr<OutputQueue> _queue;
+
+    boost::function<void (Stream*)> _on_high_water;
+    boost::function<void (Stream*)> _on_low_water;
+    boost::function<void (Stream*)> _on_queued;
+
     size_t _gcount; // number of bytes written by the << operator since gcount() was last called.
 
     int _debug_file; // if not -1, copy writes out to this. Used only for debugging.
 
+    bool _datagrams; // each write is a message of its own. See set_datagrams().
+
+    // set up (or tear down) the write buffer and output queue according to the WBUF, QUEUE and LOW_WATER options
+    void configureOutput();
+
+    // writeVector() as much of vector as the stream will take, and queue the rest behind anything already queued
+    void enqueue(const struct iovec* vector, const int count);
+
+    // send what is queued, as far as the stream will take it without waiting
+    void drainQueue();
+
+    template<typename NUMBER> void putNumber(const NUMBER item)
+    {
+        char text[NUMBER_TEXT_SIZE];
+        const size_t length = FormatNumber(item, text);
+        writeAll(length, text);
+        _gcount += length;
+    }
+
+    // apply the BUFFER_MAX and BUFFER_IDLE options
+    void configureBuffer();
+
+    // send what is pending in the write buffer followed by the pieces in vector
+    void sendOutput(const struct iovec* vector, const int count, int milliseconds_to_wait = 0);
+
+protected:
+    // the LINGER option: how long closing, or dropping QUEUE, waits in all for the other end to take what is waiting to go out.
+    // DEFAULT_LINGER if not given, or 0 with QUEUE set.
+    unsigned linger() const;
+
+    // flush(), throwing if the stream stays full for milliseconds. What is queued (QUEUE option) goes as far as it can without waiting.
+    void flushWithin(const unsigned milliseconds);
+
+    // Make length bytes of a read only mmap() the read buffer, as though they had just been read. data[length] must be mapped too, and
+    // '\0', to end it as every buffer is ended. It is munmap()ed (length + 1 bytes) when it has all been consumed, discarded or the
+    // stream closes, and reading carries on with read() after that.
+    void mapBuffer(char* data, const size_t length);
+
+    // For the constructors of streams where each write is a datagram of its own. WBUF is ignored from then on, since it would merge them.
+    void set_datagrams();
+
 public:
+    typedef boost::function<void (Stream* stream)> OutputHandler;
+
     struct DelimiterList: public std::vector<const char*>
     {
 	// Because of a limitation with va_arg ONLY primitive types can be used as ElementType in this function
@@ -104,6 +261,31 @@ public:
 	}
     };
 
+    /**
+       A piece of the read buffer lent out by the peek functions instead of a copy. It is only good until the next read, peek or
+       consume on the stream. extent is how much to consume() to get past it, which includes the delimiter even when size does not.
+    */
+    struct View
+    {
+	const char* data; // NULL when what was asked for isn't in the buffer (yet)
+	size_t size;
+	size_t extent;
+
+	View(const char* d = NULL, const size_t s = 0, const size_t e = 0) : data(d), size(s), extent(e)
+	{
+	}
+
+	explicit operator bool() const
+	{
+	    return data;
+	}
+
+	Text text() const
+	{
+	    return Text(data, size);
+	}
+    };
+
     size_t fillBuffer();
 
     enum OPTIONS
@@ -111,6 +293,8 @@ public:
         NONE, INCLUDE_DELIMITER
     };
 
+    enum { DEFAULT_LINGER = 30000 };
+
     GETSET(MiniConfig, _options);
     GETSET(Text, _option_string);
 
@@ -130,6 +314,8 @@ public:
     void set_options(const char* options)
     {
 	_options.loadFromNameValuePairs(options ? options : "");
+	configureOutput();
+	configureBuffer();
     }
 
     // These must be overidden
@@ -155,6 +341,22 @@ public:
     */
     virtual size_t write(const size_t amount, const char* const source) = 0;
 
+    /**
+       @brief  Gather write. Same contract as write(): it may write less than everything, in which case the caller resends the rest.
+       The default writes the pieces one at a time with write() and stops at the first short one. Subclasses that can do it in one
+       system call (writev) should.
+       @return how many bytes were written, across all the pieces
+    */
+    virtual size_t writeVector(const struct iovec* vector, const int count);
+
+    /**
+       @brief  Scatter read. Same contract as read(), and like read() it goes to the source directly, passing by anything already
+       buffered. The default reads the pieces one at a time with read() and stops at the first short one. Subclasses that can do it
+       in one system call (readv) should.
+       @return how many bytes were read, across all the pieces
+    */
+    virtual size_t readVector(const struct iovec* vector, const int count);
+
     // Return how many bytes have been read or written.
     virtual const unsigned long long& get_written() const = 0;
 
@@ -176,8 +378,41 @@ public:
     */
     virtual bool eof();
 
+    /**
+       @brief  Send anything sitting in the write buffer (see the WBUF option). Does nothing if there is none.
+       @note   Before WBUF, flush() threw away unread input instead. Code that called it for that must call discardBuffered() now.
+       Subclasses that override write() must flush() in their close() and destructor, or what is buffered is lost.
+    */
     virtual void flush();
 
+    // How much is waiting in the write buffer for flush(), or queued to go out (QUEUE option)
+    size_t pendingOutput() const
+    {
+	return (_output ? _output->_used : 0) + queuedOutput();
+    }
+
+    // How much is in the output queue (QUEUE option)
+    size_t queuedOutput() const
+    {
+	return _queue ? _queue->size() : 0;
+    }
+
+    // Called when more than QUEUE bytes are waiting to go out, and again when they have drained to LOW_WATER.
+    void set_watermark_handlers(const OutputHandler& high_water, const OutputHandler& low_water)
+    {
+	_on_high_water = high_water;
+	_on_low_water = low_water;
+    }
+
+    // Called when output starts queuing on a stream that had none queued. The Reactor uses it to know to wait for writability.
+    void set_queue_watcher(const OutputHandler& watcher)
+    {
+	_on_queued = watcher;
+    }
+
+    // Throw away anything read into the buffer but not consumed yet. This was flush() before WBUF.
+    void discardBuffered();
+
     virtual bool isWriteReady(const unsigned timeout_milliseconds = 0) = 0;
 
     virtual bool isReadReady(const unsigned timeout_milliseconds = 0) = 0;
@@ -188,6 +423,17 @@ public:
     */
     virtual size_t writeAll(const size_t total_amount, const char* const original_source, int milliseconds_to_wait = 0);
 
+    /** @brief   writeAll() for several pieces at once, for instance a header and a payload. They go out together through writeVector(),
+	or into the write buffer if there is one and they fit.
+	@return  The total length of the pieces. If a failure occurs, an exception is thrown.
+    */
+    virtual size_t writeAllVector(const struct iovec* vector, const int count, int milliseconds_to_wait = 0);
+
+    /** @brief   readAll() scattered into several pieces. Either fills ALL of them, or none.
+	@return  The total length of the pieces if they were filled, 0 otherwise. No data is removed from the stream if 0 is read.
+    */
+    virtual size_t readAllVector(const struct iovec* vector, const int count);
+
     /** @brief   Performs a buffered, non-blocking read. Either reads ALL of the requested length, or none.
 	@amount  How many bytes to read from the stream.
 	@source  Where to put them.
@@ -195,6 +441,13 @@ public:
     */
     virtual size_t readAll(size_t amount, char* destination);
 
+    /** @brief   readAll() that waits for the data instead of giving up when it isn't all there yet. Unlike readAll(), what has arrived is
+	taken out as it comes, and big reads go straight to destination rather than through the buffer.
+	@timeout_milliseconds  How long to wait for all of it. -1 waits as long as it takes.
+	@return  amount, or less if the time ran out or the stream ended first: that much of destination is filled.
+    */
+    virtual size_t readAllWithTimeout(const size_t amount, char* destination, const int timeout_milliseconds);
+
     /** @brief   Does a printf to the stream
 	@format  A printf style format string.
 	@...     A printf style list of arguments.
@@ -216,10 +469,41 @@ public:
 
     virtual Text readToDelimiterString(const char* delimiter = "\n", const Stream::OPTIONS options = Stream::NONE);
 
+    /** @brief  Like readToDelimiterStrings() but nothing is copied or removed from the stream. Call consume(view.extent) when done with it.
+	Unlike readToDelimiterStrings(), an empty line is distinguishable from no line: it has a data pointer.
+    */
+    View peekToDelimiters(const Stream::DelimiterList& delimiters = DelimiterList(2, "\n", "\r"), const Stream::OPTIONS options = Stream::NONE);
+
+    View peekToDelimiter(const char* delimiter = "\n", const Stream::OPTIONS options = Stream::NONE);
+
+    /** @brief  Like readAll() but lends out the bytes in place instead of copying them. Nothing is removed from the stream.
+	@return a View of exactly amount bytes, or an empty View if that many could not be buffered.
+    */
+    View peek(const size_t amount);
+
+    /** @brief  Remove data from the front of the buffer, usually after looking at it through a View.
+	@return how much was removed, which is less than amount if less was buffered.
+    */
+    size_t consume(const size_t amount);
+
     const char* FirstDelimiter(const Stream::DelimiterList& delimiters);
 
+    /** @brief  Find the earliest of the delimiters in the unread part of the buffer, in one pass. Data already searched
+	for the same delimiters by an earlier call that came up empty is not searched again.
+	@param  which  set to the index in delimiters of the one found
+	@return where in the buffer it starts, or NULL if none is there yet.
+    */
+    const char* findDelimiter(const Stream::DelimiterList& delimiters, size_t& which);
+
     virtual size_t relay(const size_t atmost, Stream* output, const char* delimiter = "\n", const Stream::OPTIONS options = Stream::NONE);
 
+    /** @brief  Move up to max bytes from this stream to out, without waiting. Data already buffered here goes first. Streams
+	that can do better (FileDescriptorStream: sendfile, splice, copy_file_range) override this; this one reads into the buffer
+	and write()s out of it.
+	@return how many bytes reached out. 0 when there is nothing to read or out can't take anything right now.
+    */
+    virtual size_t transferTo(Stream& out, const size_t max);
+
     // Create a new, unopened version of me.
     virtual Stream* CopyNew() const = 0;
 
@@ -229,11 +513,24 @@ public:
 
     virtual bool hasBuffered() const;
 
+    // number of bytes read in from the resource but not yet taken out of the buffer
+    size_t buffered() const
+    {
+	return _buffer->_insert_point - _buffer->_read_point;
+    }
+
     virtual bool isFinite() const;
 
     virtual void resizeBuffer(const size_t newsize)
     {
 	_buffer->resize(newsize);
+	_buffer->_base_size = newsize;
+    }
+
+    // Cut the read buffer down to what it holds right now, to nothing if it is empty. For sweeping idle connections.
+    void trimBuffer()
+    {
+	_buffer->shrink();
     }
 
     virtual Text PeerAddress() const;
@@ -246,14 +543,123 @@ public:
     {
         _gcount += amount;
     }
+
+    /** @brief  Write item the way operator<< would write it to a std::ostream, and count it in gcount(). Strings go straight
+	through and numbers are converted on the stack, so nothing is allocated. Any other type goes through a std::ostringstream.
+    */
+    void put(const char* item)
+    {
+        if (not item) // as an ostream would, write nothing
+            return;
+
+        const size_t length = ::strlen(item);
+        writeAll(length, item);
+        _gcount += length;
+    }
+
+    void put(char* item)
+    {
+        put(static_cast<const char*>(item));
+    }
+
+    void put(const std::string& item)
+    {
+        writeAll(item.size(), item.data());
+        _gcount += item.size();
+    }
+
+    void put(const Text& item)
+    {
+        put(static_cast<const std::string&>(item));
+    }
+
+    void put(const char item)
+    {
+        writeAll(1, &item);
+        ++_gcount;
+    }
+
+    void put(const signed char item)
+    {
+        put(static_cast<char>(item));
+    }
+
+    void put(const unsigned char item)
+    {
+        put(static_cast<char>(item));
+    }
+
+    void put(const bool item)
+    {
+        put(item ? '1' : '0');
+    }
+
+    void put(const short item)
+    {
+        putNumber<int>(item);
+    }
+
+    void put(const unsigned short item)
+    {
+        putNumber<unsigned>(item);
+    }
+
+    void put(const int item)
+    {
+        putNumber(item);
+    }
+
+    void put(const unsigned item)
+    {
+        putNumber(item);
+    }
+
+    void put(const long item)
+    {
+        putNumber(item);
+    }
+
+    void put(const unsigned long item)
+    {
+        putNumber(item);
+    }
+
+    void put(const long long item)
+    {
+        putNumber(item);
+    }
+
+    void put(const unsigned long long item)
+    {
+        putNumber(item);
+    }
+
+    void put(const float item)
+    {
+        putNumber<double>(item);
+    }
+
+    void put(const double item)
+    {
+        putNumber(item);
+    }
+
+    void put(const long double item)
+    {
+        putNumber(item);
+    }
+
+    template<typename TYPE> void put(const TYPE& item)
+    {
+        std::ostringstream temp;
+        temp << item;
+        put(temp.str());
+    }
 };
 
 template<typename TYPE> Stream& operator<<(Stream& output, const TYPE& item)
 {
-    std::stringstream temp;
-    temp << item;
-    output.writeString(temp.str());
-    output.increment_gcount(temp.str().size());
+    output.put(item);
     return output;
 }
 
@@ -7,6 +7,7 @@ $Id: StreamFactory.cc 2428 2012-08-14 15:33:13Z whoward $
 #include <TcpClientStream.h>
 #include <FileDescriptorStream.h>
 #include <TcpServiceStream.h>
+#include <TcpServiceGroup.h>
 #include <ExecStream.h>
 #include <DiskFileStream.h>
 #include <StringAsStream.h>
@@ -19,6 +20,8 @@ $Id: StreamFactory.cc 2428 2012-08-14 15:33:13Z whoward $
 #include <UnixSockDgramClientStream.h>
 #include <Enhanced.h>
 #include <StlHelpers.h>
+#include <unordered_map>
+#include <string>
 
 const char* Divider = "\n\t\t\t\t\t\t\t";
 
@@ -39,6 +42,168 @@ const char* url_resource(const char* url)
     return url;
 }
 
+namespace
+{
+    struct Scheme
+    {
+	std::string _name;
+	StreamMaker _make;
+	STREAM_KIND _kind;
+    };
+
+    typedef std::unordered_map<std::string, Scheme> Schemes;
+
+    Stream* MakeNullStream(const char*, const char*)
+    {
+	return new NullStream();
+    }
+
+    SocketStream* MakeNullSocketStream(const char*, const char*)
+    {
+	return new NullSocketStream();
+    }
+
+    FileDescriptorStream* MakeHandleStream(const char* resource, const char* options)
+    {
+	if (not strcasecmp(resource, "stdout"))
+	    return new FileDescriptorStream("standard_out", options, -2, 1);
+
+	if (not strcasecmp(resource, "stderr"))
+	    return new FileDescriptorStream("standard_error", options, -2, 2);
+
+	if (not strcasecmp(resource, "stdin"))
+	    return new FileDescriptorStream("standard_in", options, 0, -2);
+
+	int descriptor = atoi(resource);
+	return new FileDescriptorStream(StringPrintf(0, "file_handle:%d", descriptor).c_str(), options, descriptor, descriptor);
+    }
+
+    void Add(Schemes& schemes, const char* name, const StreamMaker& make, const STREAM_KIND kind)
+    {
+	Scheme& scheme = schemes[name];
+	scheme._name = name;
+	scheme._make = make;
+	scheme._kind = kind;
+    }
+
+    Schemes& BuiltIn()
+    {
+	static Schemes schemes;
+
+	Add(schemes, "string", &MakeStreamOf<StringAsStream>, PLAIN_STREAM);
+	Add(schemes, "null", &MakeNullStream, PLAIN_STREAM);
+
+	Add(schemes, "exec", &MakeStreamOf<ExecStream>, FILE_DESCRIPTOR_STREAM);
+	Add(schemes, "handle", &MakeHandleStream, FILE_DESCRIPTOR_STREAM);
+	Add(schemes, "file", &MakeStreamOf<DiskFileStream>, FILE_DESCRIPTOR_STREAM);
+	Add(schemes, "pipe", &MakeStreamOf<NamedPipeStream>, FILE_DESCRIPTOR_STREAM);
+
+	Add(schemes, "tcp_service", &MakeStreamOf<TcpServiceStream>, SOCKET_STREAM);
+	Add(schemes, "tcp", &MakeStreamOf<TcpClientStream>, SOCKET_STREAM);
+	Add(schemes, "udp", &MakeStreamOf<UdpClientStream>, SOCKET_STREAM);
+	Add(schemes, "udp_service", &MakeStreamOf<UdpServiceStream>, SOCKET_STREAM);
+	Add(schemes, "unixdgram", &MakeStreamOf<UnixSockDgramClientStream>, SOCKET_STREAM);
+	Add(schemes, "unix_dgram", &MakeStreamOf<UnixSockDgramClientStream>, SOCKET_STREAM); // as the help spells it
+	Add(schemes, "unixdgramsvc", &MakeStreamOf<UnixSockDgramServiceStream>, SOCKET_STREAM);
+	Add(schemes, "unix_dgram_svc", &MakeStreamOf<UnixSockDgramServiceStream>, SOCKET_STREAM);
+	Add(schemes, "nullsocket", &MakeNullSocketStream, SOCKET_STREAM);
+
+	return schemes;
+    }
+
+    // Built in schemes are there before anybody, static initializers included, can register or look one up.
+    Schemes& AllSchemes()
+    {
+	static Schemes& schemes = BuiltIn();
+	return schemes;
+    }
+
+    /**
+       Split url, in one pass, into its scheme, resource, and options, which follow a , or @ and replace ops. A url without a
+       scheme gets default_protocol's.
+       @return  the scheme, or NULL if it isn't registered or isn't at least of kind
+    */
+    const Scheme* Parse(const char* url, const char* ops, const char* default_protocol, const STREAM_KIND kind, std::string& resource, std::string& options)
+    {
+	std::string prefixed;
+
+	if (strcspn(url, ":") > 16 or not strchr(url, ':'))
+	{
+	    prefixed.assign(default_protocol).append(url);
+	    url = prefixed.c_str();
+	}
+
+	const char* colon = strchr(url, ':');
+	if (not colon)
+	    return NULL;
+
+	const char* end = url + strlen(url);
+
+	options = NO_NULL_STR(ops);
+
+	// options follow a @, or a ,
+	if (const char* at = strchr(url, '@'))
+	{
+	    options.assign(at + 1);
+	    end = at;
+	}
+
+	if (const char* comma = static_cast<const char*>(memchr(url, ',', end - url)))
+	{
+	    options.assign(comma + 1, end - comma - 1);
+	    end = comma;
+	}
+
+	Schemes& schemes = AllSchemes();
+	Schemes::const_iterator scheme = schemes.find(std::string(url, colon - url));
+
+	if (scheme == schemes.end() or scheme->second._kind < kind)
+	    return NULL;
+
+	// skip past one or two /
+	const char* start = colon + 1;
+	if (*start == '/' and ++start < end and *start == '/')
+	    ++start;
+
+	resource.assign(start, start < end ? end - start : 0);
+
+	return &scheme->second;
+    }
+
+    Stream* Make(const char* url, const char* ops, const char* default_protocol, const STREAM_KIND kind)
+    {
+	std::string resource;
+	std::string options;
+
+	const Scheme* scheme = Parse(url, ops, default_protocol, kind, resource, options);
+
+	if (not scheme)
+	    throw Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "Unknown resource: \"%s\"", url);
+
+	return scheme->_make(resource.c_str(), options.c_str());
+    }
+
+    // the standard handles by name, or NULL
+    FileDescriptorStream* StandardHandle(const char* url)
+    {
+	if (strequal(url, "STDOUT"))
+	    return new FileDescriptorStream("STDOUT", 0, -2, 1);
+
+	if (strequal(url, "STDERR"))
+	    return new FileDescriptorStream("STDERR", 0, -2, 2);
+
+	if (strequal(url, "STDIN"))
+	    return new FileDescriptorStream("STDIN", 0, 0, -2);
+
+	return NULL;
+    }
+}
+
+void RegisterStreamScheme(const char* scheme, const StreamMaker& make, const STREAM_KIND kind)
+{
+    Add(AllSchemes(), scheme, make, kind);
+}
+
 Text SocketStreamHelp()
 {
     Enhanced<std::vector<Text>> help(4, "tcp://test.bozo.com:40000, TIMEOUT=10\t(TCP Client with common option)",
@@ -52,7 +217,8 @@ Text SocketStreamHelp()
 
 Text SocketStreamServiceHelp()
 {
-    Enhanced<std::vector<Text>> help(3, "tcp_service://test.bozo.com:40000\t(TCP Service, wait for connections)",
+    Enhanced<std::vector<Text>> help(4, "tcp_service://test.bozo.com:40000\t(TCP Service, wait for connections)",
+				     "tcp_service://0.0.0.0:40000,REUSEPORT=4 AFFINITY\t(TCP Service sharing its port, one listener per worker)",
 				     "udp_service://0.0.0.0:514\t(UDP Service, wait for datagrams)",
 				     "unix_dgram_svc://filename\t(Unix datagram socket)"
 	);
@@ -61,62 +227,20 @@ Text SocketStreamServiceHelp()
 
 SocketStream* SocketStreamFactoryInternal(const char* url, const char* ops, const char* default_protocol)
 {
-    char resource[2048];
-    char options[1024];
-
-    if (strcspn(url, ":") > 16 or !strchr(url, ':'))
-	snprintf(resource, sizeof(resource), "%s%s", default_protocol, url);
-    else
-	strncpy(resource, url, sizeof(resource));
+    return static_cast<SocketStream*>(Make(url, ops, default_protocol, SOCKET_STREAM));
+}
 
-    strncpy(options, NO_NULL_STR(ops), sizeof options);
+TcpServiceGroup* TcpServiceGroupFactory(const char* url, const char* ops)
+{
+    std::string resource;
+    std::string options;
 
-    // allow data following a @ in the url to be options
-    char* p = strchr(resource, '@');
-    if (p)
-    {
-	*p = '\0';
-	strncpy(options, p + 1, sizeof(options));
-    }
+    const Scheme* scheme = Parse(url, ops, "tcp_service://", SOCKET_STREAM, resource, options);
 
-    // allow data following a , in the url to be options
-    p = strchr(resource, ',');
-    if (p)
-    {
-	*p = '\0';
-	strncpy(options, p + 1, sizeof(options));
-    }
+    if (not scheme or scheme->_name != "tcp_service")
+	throw Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "Not a tcp_service: \"%s\"", url);
 
-    if (strstr(resource, "tcp_service:") == resource)
-    {
-	return new TcpServiceStream(url_resource(resource), options);
-    }
-    else if (strstr(resource, "tcp:") == resource)
-    {
-        return new TcpClientStream(url_resource(resource), options);
-    }
-    else if (strstr(resource, "udp:") == resource)
-    {
-	return new UdpClientStream(url_resource(resource), options);
-    }
-    else if (strstr(resource, "udp_service:") == resource)
-    {
-	return new UdpServiceStream(url_resource(resource), options);
-    }
-    else if (strstr(resource, "unixdgram:") == resource)
-    {
-	return new UnixSockDgramClientStream(url_resource(resource), options);
-    }
-    else if (strstr(resource, "unixdgramsvc:") == resource)
-    {
-	return new UnixSockDgramServiceStream(url_resource(resource), options);
-    }
-    else if (strstr(resource, "nullsocket:") == resource)
-    {
-	return new NullSocketStream();
-    }
-    else
-	throw Exception(LOCATION, StringPrintf(0, "Unknown resource: \"%s\"", url).c_str(), Exception::NO_SYSTEM_ERROR);
+    return new TcpServiceGroup(resource.c_str(), options.c_str());
 }
 
 Text FileDescriptorStreamHelp()
@@ -133,76 +257,10 @@ Text FileDescriptorStreamHelp()
 
 FileDescriptorStream* FileDescriptorStreamFactoryInternal(const char* url, const char* ops, const char* default_protocol)
 {
-    if (strequal(url, "STDOUT"))
-    {
-        return new FileDescriptorStream("STDOUT", 0, -2, 1);
-    }
-    else if (strequal(url, "STDERR"))
-    {
-        return new FileDescriptorStream("STDERR", 0, -2, 2);
-    }
-    else if (strequal(url, "STDIN"))
-    {
-        return new FileDescriptorStream("STDIN", 0, 0, -2);
-    }
-
-    char resource[2048];
-    char options[1024];
-
-    if (strcspn(url, ":") > 16 or !strchr(url, ':'))
-	snprintf(resource, sizeof(resource), "%s%s", default_protocol, url);
-    else
-	strncpy(resource, url, sizeof(resource));
-
-    strncpy(options, NO_NULL_STR(ops), sizeof options);
-
-    // allow data following a @ in the url to be options
-    char* p = strchr(resource, '@');
-    if (p)
-    {
-	*p = '\0';
-	strncpy(options, p + 1, sizeof(options));
-    }
-
-    // allow data following a , in the url to be options
-    p = strchr(resource, ',');
-    if (p)
-    {
-	*p = '\0';
-	strncpy(options, p + 1, sizeof(options));
-    }
-
-    if (strstr(resource, "exec:") == resource)
-    {
-        return new ExecStream(url_resource(resource), options);
-    }
-    else if (not strcasecmp(resource, "handle:stdout"))
-    {
-        return new FileDescriptorStream("standard_out", options, -2, 1);
-    }
-    else if (not strcasecmp(resource, "handle:stderr"))
-    {
-        return new FileDescriptorStream("standard_error", options, -2, 2);
-    }
-    else if (not strcasecmp(resource, "handle:stdin"))
-    {
-        return new FileDescriptorStream("standard_in", options, 0, -2);
-    }
-    else if (strstr(resource, "handle:") == resource)
-    {
-	int descriptor = atoi(url_resource(resource));
-        return new FileDescriptorStream(StringPrintf(0, "file_handle:%d", descriptor).c_str(), options, descriptor, descriptor);
-    }
-    else if (strstr(resource, "file:") == resource)
-    {
-        return new DiskFileStream(url_resource(resource), options);
-    }
-    else if (strstr(resource, "pipe:") == resource)
-    {
-        return new NamedPipeStream(url_resource(resource), options);
-    }
+    if (FileDescriptorStream* standard = StandardHandle(url))
+	return standard;
 
-    return SocketStreamFactoryInternal(url, ops, default_protocol);
+    return static_cast<FileDescriptorStream*>(Make(url, ops, default_protocol, FILE_DESCRIPTOR_STREAM));
 }
 
 
@@ -215,55 +273,10 @@ Text StreamHelp()
 
 Stream* StreamFactoryInternal(const char* url, const char* ops, const char* default_protocol)
 {
-    char resource[2048];
-    char options[1024];
-
-    if (strequal(url, "STDOUT"))
-    {
-        return new FileDescriptorStream("STDOUT", 0, -2, 1);
-    }
-    else if (strequal(url, "STDERR"))
-    {
-        return new FileDescriptorStream("STDERR", 0, -2, 2);
-    }
-    else if (strequal(url, "STDIN"))
-    {
-        return new FileDescriptorStream("STDIN", 0, 0, -2);
-    }
-
-    if (strcspn(url, ":") > 16 or !strchr(url, ':'))
-	snprintf(resource, sizeof(resource), "%s%s", default_protocol, url);
-    else
-	strncpy(resource, url, sizeof(resource));
-
-    strncpy(options, NO_NULL_STR(ops), sizeof options);
-
-    // allow data following a @ in the url to be options
-    char* p = strchr(resource, '@');
-    if (p)
-    {
-	*p = '\0';
-	strncpy(options, p + 1, sizeof(options));
-    }
-
-    // allow data following a , in the url to be options
-    p = strchr(resource, ',');
-    if (p)
-    {
-	*p = '\0';
-	strncpy(options, p + 1, sizeof(options));
-    }
-
-    if (strstr(resource, "string:") == resource)
-    {
-        return new StringAsStream(url_resource(resource), options);
-    }
-    else if (strstr(resource, "null:") == resource)
-    {
-        return new NullStream();
-    }
+    if (FileDescriptorStream* standard = StandardHandle(url))
+	return standard;
 
-    return FileDescriptorStreamFactoryInternal(url, ops, default_protocol);
+    return Make(url, ops, default_protocol, PLAIN_STREAM);
 }
 
 StreamPtr StreamFactory(const char* url, const char* options, const char* default_protocol)
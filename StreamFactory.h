@@ -8,6 +8,7 @@ Copyright 2009 by Walt Howard
 #include <FileDescriptorStream.h>
 #include <SocketStream.h>
 #include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
 
 template <typename TYPE> class SharedPtr: public boost::shared_ptr<TYPE>
 {
@@ -52,6 +53,59 @@ StreamPtr MakeStream(const char* url, const char* options = NULL, const char* de
 FileDescriptorStreamPtr FileDescriptorStreamFactory(const char* url, const char* options = NULL, const char* default_protocol = "file://");
 SocketStreamPtr SocketStreamFactory(const char* url, const char* options = NULL, const char* default_protocol = "");
 
+/**
+   Url schemes are looked up in a table, so the factories cost the same whatever the scheme, and other code can add its own:
+
+     RegisterStreamScheme<MyTransportStream>("mytransport");
+
+   makes "mytransport://somewhere,SOME OPTIONS" a new MyTransportStream("somewhere", "SOME OPTIONS"). A SocketStream is made by all
+   three factories, a FileDescriptorStream by StreamFactory and FileDescriptorStreamFactory, any other Stream by StreamFactory
+   only. Registering a scheme again replaces it. Register from main() or a static initializer, before other threads make streams.
+*/
+typedef boost::function<Stream* (const char* resource, const char* options)> StreamMaker;
+
+enum STREAM_KIND { PLAIN_STREAM, FILE_DESCRIPTOR_STREAM, SOCKET_STREAM };
+
+inline STREAM_KIND StreamKind(const Stream*)
+{
+    return PLAIN_STREAM;
+}
+
+inline STREAM_KIND StreamKind(const FileDescriptorStream*)
+{
+    return FILE_DESCRIPTOR_STREAM;
+}
+
+inline STREAM_KIND StreamKind(const SocketStream*)
+{
+    return SOCKET_STREAM;
+}
+
+// make must return a stream of kind. The templates below work that out for you.
+void RegisterStreamScheme(const char* scheme, const StreamMaker& make, const STREAM_KIND kind);
+
+template <typename STREAM> Stream* MakeStreamOf(const char* resource, const char* options)
+{
+    return new STREAM(resource, options);
+}
+
+// scheme makes a STREAM with its (resource, options) constructor
+template <typename STREAM> void RegisterStreamScheme(const char* scheme)
+{
+    RegisterStreamScheme(scheme, &MakeStreamOf<STREAM>, StreamKind(static_cast<STREAM*>(NULL)));
+}
+
+// scheme makes whatever make returns
+template <typename STREAM> void RegisterStreamScheme(const char* scheme, STREAM* (*make)(const char* resource, const char* options))
+{
+    RegisterStreamScheme(scheme, StreamMaker(make), StreamKind(static_cast<STREAM*>(NULL)));
+}
+
+class TcpServiceGroup;
+
+// tcp_service://host:port,REUSEPORT=N as N listeners sharing the port. See TcpServiceGroup.
+TcpServiceGroup* TcpServiceGroupFactory(const char* url, const char* options = NULL);
+
 Text StreamHelp();
 Text FileDescriptorStreamHelp();
 Text SocketStreamHelp();
@@ -36,18 +36,55 @@ bool StringAsStream::eof()
 
 void StringAsStream::close()
 {
+    if (pendingOutput()) // WBUF: what is still in the write buffer belongs in the string
+	flush();
+
     _position = _data.end();
+    Stream::close();
 }
 
 
 size_t StringAsStream::write(const size_t amount, const char* const source)
 {
-    _data.append(source);
+    const size_t position = _position - _data.begin(); // appending can move the string
+    _data.append(source, amount);
+    _position = _data.begin() + position;
     _written += amount;
     return amount;
 }
 
 
+size_t StringAsStream::writeVector(const struct iovec* vector, const int count)
+{
+    size_t total(0);
+
+    for (int i = 0; i < count; ++i)
+	total += vector[i].iov_len;
+
+    const size_t position = _position - _data.begin();
+    _data.reserve(_data.size() + total);
+
+    for (int i = 0; i < count; ++i)
+	_data.append(static_cast<const char*>(vector[i].iov_base), vector[i].iov_len);
+
+    _position = _data.begin() + position;
+
+    _written += total;
+    return total;
+}
+
+
+size_t StringAsStream::readVector(const struct iovec* vector, const int count)
+{
+    size_t total(0);
+
+    for (int i = 0; i < count; ++i)
+	total += read(vector[i].iov_len, static_cast<char*>(vector[i].iov_base));
+
+    return total;
+}
+
+
 bool StringAsStream::isWriteReady(const unsigned timeout_milliseconds)
 {
     return true;
@@ -83,6 +120,13 @@ size_t StringAsStream::read(const size_t max_read, char* destination)
     return length;
 }
 
+StringAsStream::~StringAsStream()
+{
+    // Stream's destructor can't: by then this part of the object, and its write(), are gone
+    if (pendingOutput())
+	flush();
+}
+
 StringAsStream* StringAsStream::CopyNew() const
 {
     StringAsStream* temp = new StringAsStream(get_resource().c_str(), get_option_string().c_str());
@@ -36,6 +36,10 @@ public:
 
     virtual size_t write(const size_t amount, const char* const source);
 
+    virtual size_t readVector(const struct iovec* vector, const int count);
+
+    virtual size_t writeVector(const struct iovec* vector, const int count);
+
     virtual bool isWriteReady(const unsigned timeout_milliseconds = 0);
 
     virtual bool isReadReady(const unsigned timeout_milliseconds = 0);
@@ -45,6 +49,9 @@ public:
     virtual const unsigned long long& get_read() const;
 
     virtual StringAsStream* CopyNew() const;
+
+    // sends anything still in the write buffer (WBUF) into the string
+    virtual ~StringAsStream();
 };
 
 
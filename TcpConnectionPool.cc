@@ -0,0 +1,230 @@
+/*
+Copyright 2009 by Walt Howard
+$Id: TcpConnectionPool.cc 2428 2012-08-14 15:33:13Z whoward $
+*/
+
+#include <TcpConnectionPool.h>
+#include <boost/thread/thread_time.hpp>
+#include <sys/socket.h>
+#include <time.h>
+
+TcpConnectionPool::TcpConnectionPool(const size_t max_idle, const size_t max_per_host, const unsigned idle_timeout_milliseconds)
+    : _max_idle(max_idle), _max_per_host(max_per_host), _idle_timeout(idle_timeout_milliseconds)
+{
+}
+
+uint64_t TcpConnectionPool::Now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+bool TcpConnectionPool::Alive(TcpClientStream* stream)
+{
+    if (stream->get_fd_eof() or stream->buffered())
+	return false;
+
+    // 0 is the server hanging up, data is a response nobody is waiting for. Either way the connection is no good.
+    char peek;
+    ssize_t rval = ::recv(stream->get_read_fd(), &peek, 1, MSG_PEEK | MSG_DONTWAIT);
+
+    return rval == -1 and (errno == EAGAIN or errno == EWOULDBLOCK);
+}
+
+void TcpConnectionPool::expire(Host& host, const uint64_t now, std::vector<TcpClientStream*>& dead)
+{
+    while (not host._idle.empty() and now - host._idle.front()._since >= _idle_timeout)
+    {
+	dead.push_back(host._idle.front()._stream);
+	host._idle.pop_front();
+	--host._connections;
+    }
+}
+
+TcpClientStream* TcpConnectionPool::checkout(const char* address, const char* options, const unsigned wait_milliseconds)
+{
+    IpSocketAddress resolved(address);
+
+    const Text key = resolved.asString() + " " + (options ? options : "");
+
+    const boost::system_time deadline = boost::get_system_time() + boost::posix_time::milliseconds(wait_milliseconds);
+
+    TcpClientStream* stream = NULL;
+    std::vector<TcpClientStream*> dead;
+
+    {
+	boost::mutex::scoped_lock lock(_lock);
+
+	Host& host = _hosts[key];
+
+	for (;;)
+	{
+	    expire(host, Now(), dead);
+
+	    while (not stream and not host._idle.empty())
+	    {
+		TcpClientStream* idle = host._idle.back()._stream;
+		host._idle.pop_back();
+
+		if (Alive(idle))
+		    stream = idle;
+		else
+		{
+		    dead.push_back(idle);
+		    --host._connections;
+		}
+	    }
+
+	    if (stream)
+	    {
+		_checked_out[stream] = key;
+		break;
+	    }
+
+	    if (not _max_per_host or host._connections < _max_per_host)
+	    {
+		++host._connections; // hold the slot while connecting
+		break;
+	    }
+
+	    ++host._waiting;
+	    bool woken = _returned.timed_wait(lock, deadline);
+	    --host._waiting;
+
+	    if (not woken and host._idle.empty() and host._connections >= _max_per_host)
+	    {
+		lock.unlock();
+		for (size_t i = 0; i < dead.size(); ++i)
+		    delete dead[i];
+		throw Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "All %zu connections to %s are in use", _max_per_host, resolved.asString().c_str());
+	    }
+	}
+    }
+
+    for (size_t i = 0; i < dead.size(); ++i)
+	delete dead[i];
+
+    if (stream)
+	return stream;
+
+    try
+    {
+	stream = new TcpClientStream(resolved.asString().c_str(), options);
+	stream->open();
+    }
+    catch (...)
+    {
+	delete stream;
+
+	boost::mutex::scoped_lock lock(_lock);
+	--_hosts[key]._connections;
+	_returned.notify_all();
+
+	throw;
+    }
+
+    boost::mutex::scoped_lock lock(_lock);
+    _checked_out[stream] = key;
+
+    return stream;
+}
+
+void TcpConnectionPool::giveBack(TcpClientStream* stream, const bool reusable)
+{
+    std::vector<TcpClientStream*> dead;
+
+    {
+	boost::mutex::scoped_lock lock(_lock);
+
+	std::map<TcpClientStream*, Text>::iterator out = _checked_out.find(stream);
+
+	if (out == _checked_out.end())
+	    throw Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "Stream to %s was not checked out of this pool", stream->get_resource().c_str());
+
+	Host& host = _hosts[out->second];
+	_checked_out.erase(out);
+
+	const uint64_t now = Now();
+
+	if (reusable and not stream->get_fd_eof() and not stream->buffered() and host._idle.size() < _max_idle)
+	{
+	    Idle idle = { stream, now };
+	    host._idle.push_back(idle);
+	}
+	else
+	{
+	    dead.push_back(stream);
+	    --host._connections;
+	}
+
+	expire(host, now, dead);
+
+	_returned.notify_all();
+    }
+
+    for (size_t i = 0; i < dead.size(); ++i)
+	delete dead[i];
+}
+
+void TcpConnectionPool::checkin(TcpClientStream* stream)
+{
+    giveBack(stream, true);
+}
+
+void TcpConnectionPool::discard(TcpClientStream* stream)
+{
+    giveBack(stream, false);
+}
+
+void TcpConnectionPool::prune()
+{
+    std::vector<TcpClientStream*> dead;
+
+    {
+	boost::mutex::scoped_lock lock(_lock);
+
+	const uint64_t now = Now();
+
+	for (Hosts::iterator host = _hosts.begin(); host != _hosts.end();)
+	{
+	    expire(host->second, now, dead);
+
+	    if (not host->second._connections and not host->second._waiting)
+		_hosts.erase(host++);
+	    else
+		++host;
+	}
+
+	if (not dead.empty())
+	    _returned.notify_all();
+    }
+
+    for (size_t i = 0; i < dead.size(); ++i)
+	delete dead[i];
+}
+
+size_t TcpConnectionPool::idle() const
+{
+    boost::mutex::scoped_lock lock(_lock);
+
+    size_t count = 0;
+
+    for (Hosts::const_iterator host = _hosts.begin(); host != _hosts.end(); ++host)
+	count += host->second._idle.size();
+
+    return count;
+}
+
+size_t TcpConnectionPool::checkedOut() const
+{
+    boost::mutex::scoped_lock lock(_lock);
+    return _checked_out.size();
+}
+
+TcpConnectionPool::~TcpConnectionPool()
+{
+    for (Hosts::iterator host = _hosts.begin(); host != _hosts.end(); ++host)
+	for (size_t i = 0; i < host->second._idle.size(); ++i)
+	    delete host->second._idle[i]._stream;
+}
@@ -0,0 +1,153 @@
+/*
+Copyright 2009 by Walt Howard
+$Id: TcpConnectionPool.h 2428 2012-08-14 15:33:13Z whoward $
+*/
+
+#pragma once
+
+#include <TcpClientStream.h>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <map>
+#include <deque>
+#include <vector>
+#include <exception>
+#include <stdint.h>
+
+/**
+   Connected TcpClientStreams kept for reuse, so a request to a host that was talked to recently skips the handshake. Connections
+   are pooled by resolved address and option string: "localhost:80" and "127.0.0.1:80" share, two option strings don't.
+
+   checkout() hands out an idle connection if one is still alive, otherwise opens a new one. Give it back with checkin() when the
+   exchange is complete and nothing is left unread, or discard() it if the exchange failed part way. Lease does either for you.
+
+     max_idle      idle connections kept per host. More than that are closed when checked in.
+     max_per_host  connections per host, idle and checked out together. 0 for no limit.
+     idle_timeout  milliseconds an idle connection is kept. Servers close idle connections too; keep this below theirs.
+
+   An idle connection is checked before being handed out: if the server closed it, or sent something nobody asked for, it is
+   thrown away and the next one tried. A connection can still die between the check and its use, as always with TCP, so callers
+   retrying idempotent requests once on a fresh connection is still worthwhile.
+
+   All methods are thread safe.
+*/
+class TcpConnectionPool
+{
+    struct Idle
+    {
+	TcpClientStream* _stream;
+	uint64_t _since;
+    };
+
+    struct Host
+    {
+	std::deque<Idle> _idle; // most recently used at the back
+	size_t _connections; // idle and checked out
+	size_t _waiting; // threads in checkout() waiting for one of the _connections
+
+	Host() : _connections(0), _waiting(0)
+	{
+	}
+    };
+
+    typedef std::map<Text, Host> Hosts; // by "address options"
+
+    size_t _max_idle;
+    size_t _max_per_host;
+    unsigned _idle_timeout;
+
+    mutable boost::mutex _lock;
+    boost::condition_variable _returned;
+
+    Hosts _hosts;
+    std::map<TcpClientStream*, Text> _checked_out;
+
+    static uint64_t Now();
+
+    // not at end of file, and nothing unread in it or waiting on the socket
+    static bool Alive(TcpClientStream* stream);
+
+    // move host's connections idle too long to dead. Called with the lock held.
+    void expire(Host& host, const uint64_t now, std::vector<TcpClientStream*>& dead);
+
+    void giveBack(TcpClientStream* stream, const bool reusable);
+
+    TcpConnectionPool(const TcpConnectionPool&);
+    TcpConnectionPool& operator=(const TcpConnectionPool&);
+
+public:
+    TcpConnectionPool(const size_t max_idle = 8, const size_t max_per_host = 0, const unsigned idle_timeout_milliseconds = 60000);
+
+    GETSET(size_t, _max_idle);
+    GETSET(size_t, _max_per_host);
+    GETSET(unsigned, _idle_timeout);
+
+    /** @brief  A connected stream to address ("host:port"), reused if possible.
+	@param  wait_milliseconds  how long to wait for a connection to come back when the host is at max_per_host.
+	@throw  if the connect fails, or the host stays at max_per_host.
+    */
+    TcpClientStream* checkout(const char* address, const char* options = NULL, const unsigned wait_milliseconds = 0);
+
+    // Return a connection for reuse. One with unread data, or at end of file, is closed instead.
+    void checkin(TcpClientStream* stream);
+
+    // Close and delete a checked out connection that can't be reused.
+    void discard(TcpClientStream* stream);
+
+    // Close idle connections older than idle_timeout. checkout() and checkin() do this for their own host.
+    void prune();
+
+    size_t idle() const;
+
+    size_t checkedOut() const;
+
+    // Closes the idle connections. Check in or discard the rest first.
+    ~TcpConnectionPool();
+
+    /**
+       A checked out connection, checked back in when the Lease goes away. Call discard() on a failed exchange so a half read
+       response doesn't go back into the pool. If an exception leaves the scope the connection is discarded as well.
+    */
+    class Lease
+    {
+	TcpConnectionPool& _pool;
+	TcpClientStream* _stream;
+
+	Lease(const Lease&);
+	Lease& operator=(const Lease&);
+
+    public:
+	Lease(TcpConnectionPool& pool, const char* address, const char* options = NULL, const unsigned wait_milliseconds = 0)
+	    : _pool(pool), _stream(pool.checkout(address, options, wait_milliseconds))
+	{
+	}
+
+	TcpClientStream* operator->() const
+	{
+	    return _stream;
+	}
+
+	TcpClientStream& operator*() const
+	{
+	    return *_stream;
+	}
+
+	void discard()
+	{
+	    if (_stream)
+		_pool.discard(_stream);
+	    _stream = NULL;
+	}
+
+	~Lease()
+	{
+	    if (not _stream)
+		return;
+
+	    if (std::uncaught_exception())
+		_pool.discard(_stream);
+	    else
+		_pool.checkin(_stream);
+	}
+    };
+};
@@ -0,0 +1,64 @@
+/*
+Copyright 2009 by Walt Howard
+$Id: TcpServiceGroup.cc 2428 2012-08-14 15:33:13Z whoward $
+*/
+
+#include <TcpServiceGroup.h>
+#include <MiniConfig.h>
+#include <Misc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+TcpServiceGroup::TcpServiceGroup(const char* address_including_port, const char* options)
+{
+    MiniConfig config;
+    config.loadFromNameValuePairs(NO_NULL_STR(options));
+
+    const int shards = GREATER(atoi(config.getValue("REUSEPORT").c_str()), 1);
+    const bool affinity = not config.getValue("AFFINITY").empty();
+    const long cpus = GREATER(::sysconf(_SC_NPROCESSORS_ONLN), 1L);
+
+    Text address = NO_NULL_STR(address_including_port);
+
+    for (int i = 0; i < shards; ++i)
+    {
+	const int cpu = affinity ? i % cpus : -1;
+
+	Text shard_options = NO_NULL_STR(options);
+	if (cpu >= 0)
+	    shard_options += StringPrintf(0, " INCOMING_CPU=%d", cpu);
+
+	boost::shared_ptr<TcpServiceStream> shard(new TcpServiceStream(address.c_str(), shard_options.c_str()));
+	shard->open();
+
+	// the rest have to land on the same port even if the first one was left to choose it
+	if (i == 0)
+	    address = shard->LocalAddress();
+
+	_shards.push_back(shard);
+	_cpus.push_back(cpu);
+    }
+}
+
+void TcpServiceGroup::pinThread(const size_t shard) const
+{
+    const int cpu = _cpus.at(shard);
+
+    if (cpu < 0)
+	return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    int error = ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+    if (error)
+	throw Exception(error, LOCATION, "TcpServiceGroup: can't pin thread to cpu %d", cpu);
+}
+
+void TcpServiceGroup::close()
+{
+    for (std::vector<boost::shared_ptr<TcpServiceStream> >::iterator shard(_shards.begin()); shard != _shards.end(); ++shard)
+	(*shard)->close();
+}
@@ -0,0 +1,53 @@
+/*
+Copyright 2009 by Walt Howard
+$Id: TcpServiceGroup.h 2428 2012-08-14 15:33:13Z whoward $
+*/
+
+#pragma once
+
+#include <TcpServiceStream.h>
+#include <boost/shared_ptr.hpp>
+#include <vector>
+
+/**
+   Several listening sockets on one port, bound with SO_REUSEPORT, so each worker thread can own a listener and accept from its own
+   queue while the kernel load balances connections among them. Options are those of TcpServiceStream, plus:
+
+     REUSEPORT=N  how many listeners (shards)
+     AFFINITY     give shard i cpu i (wrapping around the cpus online). Each listener prefers connections whose packets that cpu
+                  handles (SO_INCOMING_CPU), and the worker can pin itself there with pinThread().
+
+   All the listeners are open, and accepting, when the constructor returns.
+*/
+class TcpServiceGroup
+{
+    std::vector<boost::shared_ptr<TcpServiceStream> > _shards;
+
+    std::vector<int> _cpus; // -1 for no affinity
+
+    TcpServiceGroup(const TcpServiceGroup&);
+
+public:
+    TcpServiceGroup(const char* address_including_port, const char* options = NULL);
+
+    size_t size() const
+    {
+	return _shards.size();
+    }
+
+    TcpServiceStream& operator[](const size_t shard)
+    {
+	return *_shards.at(shard);
+    }
+
+    // the shard's cpu, or -1
+    int cpu(const size_t shard) const
+    {
+	return _cpus.at(shard);
+    }
+
+    // Bind the calling thread to the shard's cpu. Does nothing without AFFINITY.
+    void pinThread(const size_t shard) const;
+
+    void close();
+};
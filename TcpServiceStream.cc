@@ -40,6 +40,18 @@ void TcpServiceStream::open(const char* address_including_port, const char* opti
     THROW_ON_ERROR(setsockopt(get_read_fd(), SOL_SOCKET, SO_REUSEADDR,
 			      &yes, sizeof(yes)));
 
+    // REUSEPORT: share the port with other listeners that say the same (see TcpServiceGroup). The kernel spreads connections among them.
+    if (not get_options().getValue("REUSEPORT").empty())
+	THROW_ON_ERROR(setsockopt(get_read_fd(), SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)));
+
+    // INCOMING_CPU=n: among listeners sharing the port, prefer this one for connections whose packets cpu n handles
+    const Text& incoming_cpu = get_options().getValue("INCOMING_CPU");
+    if (not incoming_cpu.empty())
+    {
+	int cpu = atoi(incoming_cpu.c_str());
+	THROW_ON_ERROR(setsockopt(get_read_fd(), SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)));
+    }
+
     SetOptions();
 
     // allow port_range which means, "if a bind fails due to port in use, increment the port number by 1 and try again and
@@ -58,7 +70,28 @@ void TcpServiceStream::open(const char* address_including_port, const char* opti
 
 	if (rval != -1) // success!!
 	{
-	    if (-1 == ::listen(get_read_fd(), 10))
+	    // DEFER_ACCEPT=seconds: connections aren't accepted until the client sends something, or the seconds run out
+	    const Text& defer_accept = get_options().getValue("DEFER_ACCEPT");
+	    if (not defer_accept.empty())
+	    {
+		int seconds = atoi(defer_accept.c_str());
+		THROW_ON_ERROR(setsockopt(get_read_fd(), IPPROTO_TCP, TCP_DEFER_ACCEPT, &seconds, sizeof(seconds)));
+	    }
+
+	    // FASTOPEN=N: take data in the SYN, with up to N such connections waiting to be accepted
+	    const Text& fastopen = get_options().getValue("FASTOPEN");
+	    if (not fastopen.empty())
+	    {
+		int queue_length = atoi(fastopen.c_str());
+		THROW_ON_ERROR(setsockopt(get_read_fd(), IPPROTO_TCP, TCP_FASTOPEN, &queue_length, sizeof(queue_length)));
+	    }
+
+	    // BACKLOG=N: how many connections may wait to be accepted. The kernel caps it at net.core.somaxconn.
+	    int backlog = atoi(get_options().getValue("BACKLOG").c_str());
+	    if (backlog <= 0)
+		backlog = SOMAXCONN;
+
+	    if (-1 == ::listen(get_read_fd(), backlog))
 		throw Exception(LOCATION, "listen fails on %s", bind_address.asString().c_str());
 
 	    set_resource(bind_address.asString());
@@ -75,7 +108,7 @@ void TcpServiceStream::open(const char* address_including_port, const char* opti
 
 TcpServiceStream* TcpServiceStream::accept()
 {
-    int new_socket = ::accept(get_read_fd(), NULL, NULL);
+    int new_socket = ::accept4(get_read_fd(), NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
 
     if (new_socket == -1)
     {
@@ -90,6 +123,43 @@ TcpServiceStream* TcpServiceStream::accept()
     return new_stream;
 }
 
+std::vector<TcpServiceStream*> TcpServiceStream::acceptMany(const size_t max)
+{
+    std::vector<TcpServiceStream*> accepted;
+
+    try
+    {
+	while (accepted.size() < max)
+	{
+	    int new_socket = ::accept4(get_read_fd(), NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+	    if (new_socket == -1)
+	    {
+		if (errno == EAGAIN or errno == EWOULDBLOCK) // drained
+		    break;
+
+		if (errno == ECONNABORTED or errno == EINTR) // gone before we got to it
+		    continue;
+
+		if (accepted.empty())
+		    throw(Exception(LOCATION, "TCP accept failed."));
+
+		break; // hand over what we have. The error will come up again next time.
+	    }
+
+	    accepted.push_back(new TcpServiceStream(new_socket, get_resource().c_str()));
+	}
+    }
+    catch (...)
+    {
+	for (std::vector<TcpServiceStream*>::iterator i(accepted.begin()); i != accepted.end(); ++i)
+	    delete *i;
+	throw;
+    }
+
+    return accepted;
+}
+
 Text TcpServiceStream::PeerAddress() const
 {
     sockaddr address;
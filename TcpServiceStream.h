@@ -11,7 +11,16 @@ $Id: TcpServiceStream.h 2428 2012-08-14 15:33:13Z whoward $
 #include <FileDescriptorStream.h>
 #include <IpSocketAddress.h>
 #include <SocketStream.h>
-
+#include <vector>
+
+/**
+   A listening TCP socket. Options, besides those SocketStream takes:
+     BACKLOG=N       listen queue length (default SOMAXCONN)
+     DEFER_ACCEPT=S  TCP_DEFER_ACCEPT, seconds
+     FASTOPEN=N      TCP_FASTOPEN, pending fast open queue length
+     REUSEPORT       SO_REUSEPORT, so several listeners can share the port
+     INCOMING_CPU=N  SO_INCOMING_CPU, for listeners sharing a port
+*/
 class TcpServiceStream: public SocketStream
 {
 protected:
@@ -26,6 +35,11 @@ public:
 
     virtual TcpServiceStream* accept();
 
+    /** @brief  Accept everything waiting in the listen queue, up to max, in one go.
+	@return the new streams, which the caller owns. Empty if nobody was waiting.
+    */
+    std::vector<TcpServiceStream*> acceptMany(const size_t max = 64);
+
     virtual IpSocketAddress* AddressFromString(const char* address_in_string_form) const
     {
 	return new IpSocketAddress(address_in_string_form);
@@ -0,0 +1,195 @@
+/*
+Copyright 2009 by Walt Howard
+$Id: TimerWheel.cc 2428 2012-08-14 15:33:13Z whoward $
+*/
+
+#include <TimerWheel.h>
+#include <Misc.h>
+#include <time.h>
+#include <cstring>
+
+namespace {
+
+const uint64_t SlotMask = TimerWheel::SLOTS - 1;
+
+// how many ticks the wheel can see ahead
+const uint64_t Span = 1ULL << (TimerWheel::SLOT_BITS * TimerWheel::LEVELS);
+
+}
+
+void TimerWheel::Timer::cancel()
+{
+    if (_wheel)
+	_wheel->cancel(*this);
+}
+
+uint64_t TimerWheel::Now()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+TimerWheel::TimerWheel(const unsigned tick_milliseconds) :
+    _tick_milliseconds(GREATER(tick_milliseconds, 1u)), _size(0)
+{
+    ::memset(_slots, 0, sizeof(_slots));
+    _now = currentTick();
+}
+
+uint64_t TimerWheel::currentTick() const
+{
+    return Now() / _tick_milliseconds;
+}
+
+void TimerWheel::place(Timer& timer)
+{
+    if (timer._due - _now >= Span)
+	timer._due = _now + Span - 1;
+
+    // the first wheel whose reach takes in the due tick
+    unsigned level = 0;
+    while (level < LEVELS - 1 and timer._due - _now >= (1ULL << (SLOT_BITS * (level + 1))))
+	++level;
+
+    Timer** slot = &_slots[level][(timer._due >> (SLOT_BITS * level)) & SlotMask];
+
+    timer._slot = slot;
+    timer._previous = NULL;
+    timer._next = *slot;
+
+    if (*slot)
+	(*slot)->_previous = &timer;
+
+    *slot = &timer;
+}
+
+void TimerWheel::unlink(Timer& timer)
+{
+    if (timer._previous)
+	timer._previous->_next = timer._next;
+    else
+	*timer._slot = timer._next;
+
+    if (timer._next)
+	timer._next->_previous = timer._previous;
+
+    timer._previous = timer._next = NULL;
+    timer._slot = NULL;
+}
+
+void TimerWheel::arm(Timer& timer, const unsigned milliseconds)
+{
+    if (timer._wheel)
+	cancel(timer);
+
+    const uint64_t ticks = (milliseconds + _tick_milliseconds - 1) / _tick_milliseconds;
+
+    // never in a tick advance() has already been through
+    timer._due = GREATER(currentTick() + ticks, _now + 1);
+    timer._wheel = this;
+
+    place(timer);
+    ++_size;
+}
+
+void TimerWheel::cancel(Timer& timer)
+{
+    if (timer._wheel != this)
+	return;
+
+    unlink(timer);
+    timer._wheel = NULL;
+    --_size;
+}
+
+void TimerWheel::cascade(const unsigned level)
+{
+    Timer*& slot = _slots[level][(_now >> (SLOT_BITS * level)) & SlotMask];
+
+    Timer* timer = slot;
+    slot = NULL;
+
+    while (timer)
+    {
+	Timer* next = timer->_next;
+	place(*timer);
+	timer = next;
+    }
+}
+
+size_t TimerWheel::advance()
+{
+    const uint64_t current = currentTick();
+
+    if (not _size) // nothing to go through the slots for
+    {
+	_now = GREATER(_now, current);
+	return 0;
+    }
+
+    size_t fired = 0;
+
+    while (_now < current)
+    {
+	++_now;
+
+	// the higher wheels first, so what they drop lands in slots still to be reached
+	for (unsigned level = LEVELS - 1; level > 0; --level)
+	    if (not (_now & ((1ULL << (SLOT_BITS * level)) - 1)))
+		cascade(level);
+
+	Timer** slot = &_slots[0][_now & SlotMask];
+
+	// one at a time, since what each one calls may cancel the others
+	while (Timer* timer = *slot)
+	{
+	    cancel(*timer);
+
+	    Function function(timer->_function); // the timer may not outlive the call
+	    ++fired;
+
+	    if (function)
+		function();
+	}
+
+	if (not _size)
+	{
+	    _now = current;
+	    break;
+	}
+    }
+
+    return fired;
+}
+
+int TimerWheel::nextTimeout(const int timeout_milliseconds) const
+{
+    if (not _size)
+	return timeout_milliseconds;
+
+    // the first tick with something in the first wheel, or failing that, when the next wheel up drops its next slot into it
+    uint64_t tick = (_now | SlotMask) + 1;
+
+    for (uint64_t t = _now + 1; t < _now + SLOTS; ++t)
+	if (_slots[0][t & SlotMask])
+	{
+	    tick = t;
+	    break;
+	}
+
+    const uint64_t at = tick * _tick_milliseconds;
+    const uint64_t now = Now();
+
+    const int until = at > now ? LESSER(at - now, 0x7fffffffULL) : 0;
+
+    return timeout_milliseconds < 0 ? until : LESSER(until, timeout_milliseconds);
+}
+
+TimerWheel::~TimerWheel()
+{
+    for (unsigned level = 0; level < LEVELS; ++level)
+	for (unsigned slot = 0; slot < SLOTS; ++slot)
+	    while (Timer* timer = _slots[level][slot])
+		cancel(*timer);
+}
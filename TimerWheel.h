@@ -0,0 +1,143 @@
+/*
+Copyright 2009 by Walt Howard
+$Id: TimerWheel.h 2428 2012-08-14 15:33:13Z whoward $
+*/
+
+#pragma once
+
+#include <boost/function.hpp>
+#include <cstddef>
+#include <stdint.h>
+
+/**
+   Timeouts for any number of things at once: a hierarchical timing wheel on CLOCK_MONOTONIC. Arming, re-arming and cancelling are
+   constant time however many timers there are, and advance() only looks at the slots the clock has moved past.
+
+   There are LEVELS wheels of SLOTS slots. The first has one slot per tick and holds what is due within SLOTS ticks. Each one after
+   that has slots SLOTS times as long as the one before, and a slot's timers drop into the wheels below as the clock reaches it.
+   Timers fire on the first advance() at or after the tick they are due in, so never early and at most a tick late. Beyond
+   SLOTS^LEVELS ticks (49 days with 1 ms ticks) a timer is held at the longest the wheel can go.
+
+   Timers are intrusive: the wheel links in Timer objects belonging to whoever armed them, and never allocates. A Timer disarms itself
+   when it is destroyed. A wheel belongs to one thread.
+*/
+class TimerWheel
+{
+public:
+    enum { SLOT_BITS = 8, SLOTS = 1 << SLOT_BITS, LEVELS = 4 };
+
+    typedef boost::function<void ()> Function;
+
+    class Timer
+    {
+	friend class TimerWheel;
+
+	Timer* _previous;
+	Timer* _next;
+	Timer** _slot; // the list it is on
+	TimerWheel* _wheel; // NULL when it isn't armed
+	uint64_t _due; // tick
+
+	Function _function;
+
+	Timer(const Timer&);
+	Timer& operator=(const Timer&);
+
+    public:
+	Timer(const Function& function = Function()) : _previous(NULL), _next(NULL), _slot(NULL), _wheel(NULL), _due(0), _function(function)
+	{
+	}
+
+	void set_function(const Function& function)
+	{
+	    _function = function;
+	}
+
+	bool armed() const
+	{
+	    return _wheel;
+	}
+
+	void cancel();
+
+	~Timer()
+	{
+	    cancel();
+	}
+    };
+
+private:
+    Timer* _slots[LEVELS][SLOTS];
+
+    const unsigned _tick_milliseconds;
+
+    uint64_t _now; // the last tick advance() has dealt with
+
+    size_t _size;
+
+    uint64_t currentTick() const;
+
+    // link timer into the slot for its _due, as seen from _now
+    void place(Timer& timer);
+
+    void unlink(Timer& timer);
+
+    // move the timers in the slot level has reached at _now down to where they belong now
+    void cascade(const unsigned level);
+
+    TimerWheel(const TimerWheel&);
+    TimerWheel& operator=(const TimerWheel&);
+
+public:
+    TimerWheel(const unsigned tick_milliseconds = 1);
+
+    // Call timer's function milliseconds from now. An armed timer is moved.
+    void arm(Timer& timer, const unsigned milliseconds);
+
+    // Does nothing if timer isn't armed.
+    void cancel(Timer& timer);
+
+    /** @brief  Fire every timer that is due. Each is disarmed before its function is called, so the function may arm it again, or
+	arm, cancel or destroy any other.
+	@return how many fired.
+    */
+    size_t advance();
+
+    // How long a wait (for epoll, say) can be and not hold up the next timer. timeout_milliseconds (-1 forever) if that is sooner.
+    int nextTimeout(const int timeout_milliseconds) const;
+
+    size_t size() const
+    {
+	return _size;
+    }
+
+    // milliseconds on CLOCK_MONOTONIC
+    static uint64_t Now();
+
+    ~TimerWheel();
+};
+
+/**
+   A moment milliseconds after it is made, on the monotonic clock, for waits that go round a loop: each wait is for what remains
+   rather than the whole timeout again, and changing the system time doesn't stretch or cut it.
+*/
+class Deadline
+{
+    uint64_t _at;
+
+public:
+    Deadline(const unsigned milliseconds) : _at(TimerWheel::Now() + milliseconds)
+    {
+    }
+
+    unsigned remaining() const
+    {
+	const uint64_t now = TimerWheel::Now();
+	return now < _at ? _at - now : 0;
+    }
+
+    bool expired() const
+    {
+	return not remaining();
+    }
+};
@@ -3,11 +3,13 @@
 UdpClientStream::UdpClientStream(const char* address_including_socket, const char* options)
     : TcpClientStream(address_including_socket, options)
 {
+    set_datagrams();
 }
 
 UdpClientStream::UdpClientStream(const SocketAddress& address, const char* options)
     : TcpClientStream(address.asString().c_str(), options)
 {
+    set_datagrams();
 }
 
 void UdpClientStream::open(const char* address_including_socket, const char* options)
@@ -6,6 +6,7 @@ $Id: UdpClientStream.h 2428 2012-08-14 15:33:13Z whoward $
 #pragma once
 
 #include <TcpClientStream.h>
+#include <DatagramBatch.h>
 
 class UdpClientStream: public TcpClientStream
 {
@@ -22,6 +23,24 @@ public:
 
     virtual size_t write(const size_t amount, const char* const source);
 
+    // each piece is its own datagram, sent with write()
+    virtual size_t writeVector(const struct iovec* vector, const int count)
+    {
+	return Stream::writeVector(vector, count);
+    }
+
+    // Replace batch's contents with the datagrams waiting, up to its capacity, in one recvmmsg. Does not wait. @return how many.
+    size_t readBatch(DatagramBatch& batch)
+    {
+	return receiveBatch(batch);
+    }
+
+    // Send batch's pending datagrams in one sendmmsg, to the connected peer unless they were added with their own. @return how many went.
+    size_t writeBatch(DatagramBatch& batch)
+    {
+	return sendBatch(batch);
+    }
+
     Text PeerAddress() const
     {
 	return LastPeer.asString();
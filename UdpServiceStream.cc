@@ -3,11 +3,13 @@
 UdpServiceStream::UdpServiceStream(const char* address_including_socket, const char* options)
     : TcpServiceStream(address_including_socket, options)
 {
+    set_datagrams();
 }
 
 UdpServiceStream::UdpServiceStream(const IpSocketAddress& address, const char* options)
     : TcpServiceStream(address.asString().c_str(), options)
 {
+    set_datagrams();
 }
 
 size_t UdpServiceStream::read(const size_t max_read, char* destination)
@@ -59,6 +61,21 @@ size_t UdpServiceStream::write(const size_t amount, const char* const source)
     return rval;
 }
 
+size_t UdpServiceStream::readBatch(DatagramBatch& batch)
+{
+    size_t received = receiveBatch(batch);
+
+    if (received and batch[received - 1].peer)
+	LastPeer = IpSocketAddress(*batch[received - 1].peer);
+
+    return received;
+}
+
+size_t UdpServiceStream::writeBatch(DatagramBatch& batch)
+{
+    return sendBatch(batch, LastPeer, sizeof(sockaddr));
+}
+
 void UdpServiceStream::open(const char* address_including_socket, const char* options)
 {
     if (address_including_socket)
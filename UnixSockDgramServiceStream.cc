@@ -1,13 +1,16 @@
 #include <UnixSockDgramServiceStream.h>
+#include <cstddef>
 
 UnixSockDgramServiceStream::UnixSockDgramServiceStream(const char* address, const char* options)
     : SocketStream(address, options)
 {
+    set_datagrams();
 }
 
 UnixSockDgramServiceStream::UnixSockDgramServiceStream(const UnixSockAddress& address, const char* options)
     : SocketStream(address.asString().c_str(), options)
 {
+    set_datagrams();
 }
 
 size_t UnixSockDgramServiceStream::read(const size_t max_read, char* destination)
@@ -60,6 +63,28 @@ size_t UnixSockDgramServiceStream::write(const size_t amount, const char* const
     return rval;
 }
 
+size_t UnixSockDgramServiceStream::readBatch(DatagramBatch& batch)
+{
+    size_t received = receiveBatch(batch);
+
+    // an unbound sender has no address to remember
+    if (received and batch[received - 1].peer_length > offsetof(sockaddr_un, sun_path))
+    {
+	sockaddr_un peer;
+	memset(&peer, 0, sizeof(peer));
+	memcpy(&peer, batch[received - 1].peer, LESSER(static_cast<size_t>(batch[received - 1].peer_length), sizeof(peer) - 1));
+	LastPeer = UnixSockAddress(peer);
+    }
+
+    return received;
+}
+
+size_t UnixSockDgramServiceStream::writeBatch(DatagramBatch& batch)
+{
+    const UnixSockAddress& peer = LastPeer;
+    return sendBatch(batch, peer, sizeof(sockaddr_un));
+}
+
 void UnixSockDgramServiceStream::open(const char* address, const char* options)
 {
     if (address)
@@ -78,6 +103,8 @@ void UnixSockDgramServiceStream::open(const char* address, const char* options)
 
     set_descriptors(sock, sock);
 
+    SetOptions();
+
     // Unix sockets use a file as their stream. Delete it if it already exists.
     unlink(get_resource().c_str());
 
@@ -7,6 +7,13 @@ $Id: UnixSockDgramServiceStream.h 2428 2012-08-14 15:33:13Z whoward $
 
 #include <UnixSockAddress.h>
 #include <SocketStream.h>
+#include <DatagramBatch.h>
+
+/**
+   Options: input-buffer=bytes and output-buffer=bytes set SO_RCVBUF and SO_SNDBUF, as on the other socket streams. A unix
+   datagram is charged to the sender's SO_SNDBUF until the receiver reads it, so the sending side's output-buffer is what lets a
+   burst queue up. The kernel clamps both to net.core.rmem_max and wmem_max.
+*/
 
 class UnixSockDgramServiceStream: public SocketStream
 {
@@ -23,6 +30,29 @@ public:
 
     virtual size_t write(const size_t amount, const char* const source);
 
+    // each piece is its own datagram, sent with write()
+    virtual size_t writeVector(const struct iovec* vector, const int count)
+    {
+	return Stream::writeVector(vector, count);
+    }
+
+    // each piece gets its own datagram, through read() so the sender is remembered
+    virtual size_t readVector(const struct iovec* vector, const int count)
+    {
+	return Stream::readVector(vector, count);
+    }
+
+    /** @brief  Replace batch's contents with the datagrams waiting, up to its capacity, in one recvmmsg. Does not wait.
+	LastPeer becomes the sender of the last one.
+	@return how many were received, 0 if none were waiting.
+    */
+    size_t readBatch(DatagramBatch& batch);
+
+    /** @brief  Send batch's pending datagrams in one sendmmsg. Those added without a peer go to LastPeer.
+	@return how many went. The rest are still pending in batch.
+    */
+    size_t writeBatch(DatagramBatch& batch);
+
     virtual void open(const char* address_as_file_name = NULL, const char* options = NULL);
 
     virtual SocketAddress* AddressFromString(const char* address_in_string_form) const
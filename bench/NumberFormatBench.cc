@@ -0,0 +1,114 @@
+/*
+Copyright 2009 by Walt Howard
+$Id: NumberFormatBench.cc 2428 2012-08-14 15:33:13Z whoward $
+*/
+
+/**
+   ToString() and FromString() for numbers, which go through NumberFormat, against the ostringstream and istringstream they
+   replaced. Prints nanoseconds per conversion for each.
+
+   usage: NumberFormatBench [conversions]
+*/
+
+#include <Misc.h>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <vector>
+#include <sys/time.h>
+
+namespace {
+
+double Now()
+{
+    struct timeval now;
+    ::gettimeofday(&now, NULL);
+    return now.tv_sec + now.tv_usec / 1e6;
+}
+
+// what the optimizer can't throw away
+volatile double Sink;
+
+void Report(const char* what, const size_t count, const double streamed, const double formatted)
+{
+    ::printf("%-16s stream %6.1f ns  NumberFormat %6.1f ns  %5.1fx\n", what, streamed * 1e9 / count, formatted * 1e9 / count,
+	     streamed / formatted);
+}
+
+template<typename NUMBER> void Parse(const char* what, const std::vector<Text>& texts, const size_t count)
+{
+    double total = 0;
+    double start = Now();
+
+    for (size_t i = 0; i < count; ++i)
+    {
+	NUMBER number = NUMBER();
+	std::istringstream in(texts[i % texts.size()]);
+	in >> number;
+	total += number;
+    }
+
+    const double streamed = Now() - start;
+    start = Now();
+
+    for (size_t i = 0; i < count; ++i)
+	total += FromString<NUMBER>(texts[i % texts.size()]);
+
+    const double formatted = Now() - start;
+
+    Sink = total;
+    Report(what, count, streamed, formatted);
+}
+
+template<typename NUMBER> void Format(const char* what, const std::vector<NUMBER>& numbers, const size_t count)
+{
+    size_t total = 0;
+    double start = Now();
+
+    for (size_t i = 0; i < count; ++i)
+    {
+	std::ostringstream out;
+	out << numbers[i % numbers.size()];
+	total += out.str().size();
+    }
+
+    const double streamed = Now() - start;
+    start = Now();
+
+    for (size_t i = 0; i < count; ++i)
+	total += ToString(numbers[i % numbers.size()]).size();
+
+    const double formatted = Now() - start;
+
+    Sink = total;
+    Report(what, count, streamed, formatted);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    const size_t count = argc > 1 ? ::strtoul(argv[1], NULL, 10) : 1000000;
+
+    ::srand48(7);
+
+    std::vector<long long> integers;
+    std::vector<double> reals;
+    std::vector<Text> integer_texts, real_texts;
+
+    for (int i = 0; i < 1000; ++i)
+    {
+	integers.push_back(static_cast<long long>(::mrand48()) << (i % 32));
+	reals.push_back(::lrand48() % 100000000 / 100.0);
+
+	integer_texts.push_back(ToString(integers.back()));
+	real_texts.push_back(StringPrintf(0, "%.6g", reals.back()));
+    }
+
+    Parse<long long>("parse long long", integer_texts, count);
+    Parse<double>("parse double", real_texts, count);
+    Format<long long>("format long long", integers, count);
+    Format<double>("format double", reals, count);
+
+    return 0;
+}
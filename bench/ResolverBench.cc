@@ -0,0 +1,136 @@
+/*
+Copyright 2009 by Walt Howard
+$Id: ResolverBench.cc 2428 2012-08-14 15:33:13Z whoward $
+*/
+
+/**
+   Checks Resolver against the IPv4 entries in a hosts file, so it can be tried with no network: every name must come back with
+   the first address the file gives it. Then times a cached lookup against the gethostbyname_r() IpSocketAddress used to make.
+   Exits 1 if any name came back wrong.
+
+   usage: ResolverBench [hosts file] [lookups]
+*/
+
+#include <Resolver.h>
+#include <Exception.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/time.h>
+
+namespace {
+
+double Now()
+{
+    struct timeval now;
+    ::gettimeofday(&now, NULL);
+    return now.tv_sec + now.tv_usec / 1e6;
+}
+
+// the first IPv4 address each name is given
+std::map<Text, in_addr> ReadHosts(const char* path)
+{
+    std::map<Text, in_addr> hosts;
+
+    FILE* file = ::fopen(path, "r");
+    if (not file)
+	throw Exception(LOCATION, "Can't open %s", path);
+
+    char line[1024];
+    while (::fgets(line, sizeof(line), file))
+    {
+	if (char* comment = ::strchr(line, '#'))
+	    *comment = '\0';
+
+	char* save = NULL;
+	const char* address = ::strtok_r(line, " \t\n", &save);
+	in_addr in;
+
+	if (not address or not ::inet_aton(address, &in))
+	    continue;
+
+	while (const char* name = ::strtok_r(NULL, " \t\n", &save))
+	    hosts.insert(std::make_pair(Text(name), in));
+    }
+
+    ::fclose(file);
+    return hosts;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    const char* path = argc > 1 ? argv[1] : "/etc/hosts";
+    const size_t count = argc > 2 ? ::strtoul(argv[2], NULL, 0) : 100000;
+
+    const std::map<Text, in_addr> hosts = ReadHosts(path);
+
+    if (hosts.empty())
+    {
+	::printf("no IPv4 names in %s\n", path);
+	return 0;
+    }
+
+    int wrong = 0;
+    Text timed; // a name that resolved, to time
+
+    for (std::map<Text, in_addr>::const_iterator host = hosts.begin(); host != hosts.end(); ++host)
+    {
+	std::vector<in_addr> addresses;
+
+	try
+	{
+	    addresses = Resolver::Instance().lookup(host->first.c_str());
+	}
+	catch (const std::exception& ex)
+	{
+	    ::printf("%-32s %s\n", host->first.c_str(), ex.what());
+	    ++wrong;
+	    continue;
+	}
+
+	bool found = false;
+	for (size_t i = 0; i < addresses.size(); ++i)
+	    found = found or addresses[i].s_addr == host->second.s_addr;
+
+	::printf("%-32s %-16s %s\n", host->first.c_str(), ::inet_ntoa(host->second), found ? "ok" : "WRONG");
+
+	if (not found)
+	    ++wrong;
+	else if (timed.empty())
+	    timed = host->first;
+    }
+
+    if (timed.empty())
+	return 1;
+
+    const char* name = timed.c_str();
+
+    double start = Now();
+
+    for (size_t i = 0; i < count; ++i)
+	Resolver::Instance().resolve(name);
+
+    const double cached = Now() - start;
+
+    start = Now();
+
+    for (size_t i = 0; i < count; ++i)
+    {
+	struct hostent entry;
+	struct hostent* result;
+	char scratch[1024];
+	int error;
+	::gethostbyname_r(name, &entry, scratch, sizeof(scratch), &result, &error);
+    }
+
+    const double system = Now() - start;
+
+    ::printf("%s: gethostbyname_r %.1f ns  Resolver %.1f ns\n", name, system * 1e9 / count, cached * 1e9 / count);
+
+    return wrong ? 1 : 0;
+}
@@ -0,0 +1,170 @@
+/*
+Copyright 2009 by Walt Howard
+$Id: UringBench.cc 2428 2012-08-14 15:33:13Z whoward $
+*/
+
+/**
+   Streams with and without the URING option, which is io_uring against plain ::read and ::write: a file written a line at a time
+   and read back, then lines over a loopback TCP connection. Prints MB/s for each.
+
+   usage: UringBench [lines] [file]
+*/
+
+#include <DiskFileStream.h>
+#include <TcpServiceStream.h>
+#include <TcpClientStream.h>
+#include <IoUring.h>
+#include <Exception.h>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/time.h>
+
+namespace {
+
+const char* const Payload = "abcdefghijklmnopqrstuvwxyz0123456789";
+
+double Now()
+{
+    struct timeval now;
+    ::gettimeofday(&now, NULL);
+    return now.tv_sec + now.tv_usec / 1e6;
+}
+
+size_t WriteFile(const char* path, const char* options, const size_t lines)
+{
+    ::unlink(path);
+
+    DiskFileStream file(path, (Text("WRITE CREAT TRUNC ") + options).c_str());
+    file.open();
+
+    size_t bytes = 0;
+    char line[64];
+
+    for (size_t i = 0; i < lines; ++i)
+    {
+	const int length = ::snprintf(line, sizeof(line), "line %zu %s\n", i, Payload);
+	file.writeAll(length, line);
+	bytes += length;
+    }
+
+    file.close();
+    return bytes;
+}
+
+// the number of lines read, after checking every one of them
+size_t ReadFile(const char* path, const char* options)
+{
+    DiskFileStream file(path, (Text("READ ") + options).c_str());
+    file.open();
+
+    size_t lines = 0;
+    char expected[64];
+
+    for (;;)
+    {
+	const Stream::View line = file.peekToDelimiter("\n", Stream::INCLUDE_DELIMITER);
+
+	if (not line)
+	{
+	    if (not file.fillBuffer() and file.get_fd_eof())
+		break;
+	    continue;
+	}
+
+	const int length = ::snprintf(expected, sizeof(expected), "line %zu %s\n", lines, Payload);
+
+	if (static_cast<size_t>(length) != line.size or ::memcmp(expected, line.data, length))
+	    throw Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "line %zu came back wrong", lines);
+
+	file.consume(line.extent);
+	++lines;
+    }
+
+    return lines;
+}
+
+// MB/s of messages from a client to a server, both with options
+double Socket(const char* options, const size_t messages)
+{
+    TcpServiceStream listener("127.0.0.1:18781");
+    listener.open();
+
+    TcpClientStream client("127.0.0.1:18781", options);
+    client.open();
+
+    TcpServiceStream* server = NULL;
+    while (not (server = listener.accept()))
+	::usleep(1000);
+
+    server->set_option_string(options);
+
+    const Text message("hello there socket\n");
+    size_t sent = 0, received = 0;
+    const double start = Now();
+
+    while (received < messages)
+    {
+	for (; sent < messages and sent < received + 1000; ++sent)
+	    client.writeAll(message.size(), message.data());
+
+	client.flush();
+	server->isReadReady(1000);
+
+	while (const Stream::View line = server->peekToDelimiter("\n"))
+	{
+	    server->consume(line.extent);
+	    ++received;
+	}
+    }
+
+    const double elapsed = Now() - start;
+    delete server;
+
+    return received * message.size() / 1e6 / elapsed;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    const size_t lines = argc > 1 ? ::strtoul(argv[1], NULL, 10) : 4000000;
+    const char* path = argc > 2 ? argv[2] : "/tmp/UringBench.dat";
+
+    ::printf("io_uring %s\n", IoUring::ForThread() ? "available" : "not available: URING falls back to ::read and ::write");
+
+    try
+    {
+	for (int round = 0; round < 2; ++round) // the first round warms the page cache
+	{
+	    const char* modes[] = { "", "URING" };
+
+	    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m)
+	    {
+		const double start = Now();
+		const size_t bytes = WriteFile(path, modes[m], lines);
+		const double written = Now();
+		const size_t read = ReadFile(path, modes[m]);
+		const double finished = Now();
+
+		if (read != lines)
+		    throw Exception(Exception::NO_SYSTEM_ERROR, LOCATION, "%zu lines written, %zu read", lines, read);
+
+		::printf("%-6s file   write %6.0f MB/s  read %6.0f MB/s\n", *modes[m] ? "uring" : "plain", bytes / 1e6 / (written - start),
+			 bytes / 1e6 / (finished - written));
+	    }
+	}
+
+	::printf("plain  socket %6.0f MB/s\n", Socket("", lines / 20));
+	::printf("uring  socket %6.0f MB/s\n", Socket("URING", lines / 20));
+    }
+    catch (const std::exception& ex)
+    {
+	::fprintf(stderr, "%s\n", ex.what());
+	::unlink(path);
+	return 1;
+    }
+
+    ::unlink(path);
+    return 0;
+}